@@ -4,7 +4,7 @@
 BoundingBox::BoundingBox() {
 }
 
-BoundingBox::BoundingBox(vector<int> thatLow, vector<int> thatHigh) {
+BoundingBox::BoundingBox(vector<coord_t> thatLow, vector<coord_t> thatHigh) {
 	if (thatHigh.size() != thatLow.size())
 	{
 		cerr << "lowest and highest point of rectangle should have the same length\n";
@@ -21,11 +21,11 @@ BoundingBox::BoundingBox(const BoundingBox& thatBox) {
 	this->highest = thatBox.highest;
 }
 
-const vector<int>& BoundingBox::get_lowest() const {
+const vector<coord_t>& BoundingBox::get_lowest() const {
 	return this->lowest;
 }
 
-const vector<int>& BoundingBox::get_highest() const {
+const vector<coord_t>& BoundingBox::get_highest() const {
 	return this->highest;
 }
 
@@ -33,22 +33,23 @@ int BoundingBox::get_dim() const {
 	return this->lowest.size();
 }
 
-int BoundingBox::get_area() const {
-	int area = 1;
+area_t BoundingBox::get_area() const {
+	area_t area = 1;
 
+	//each side is widened before the subtraction, so neither it nor the product overflows
 	for (int cIndex = 0; cIndex < this->get_dim(); cIndex++)
 	{
-		area *= this->highest[cIndex] - this->lowest[cIndex];
+		area *= (area_t)this->highest[cIndex] - (area_t)this->lowest[cIndex];
 	}
 
 	return area;
 }
 
-int BoundingBox::get_lowestValue_at(const int index) const {
+coord_t BoundingBox::get_lowestValue_at(const int index) const {
 	return this->lowest[index];
 }
 
-int BoundingBox::get_highestValue_at(const int index) const {
+coord_t BoundingBox::get_highestValue_at(const int index) const {
 	return this->highest[index];
 }
 
@@ -69,8 +70,8 @@ bool BoundingBox::is_intersected(const BoundingBox& rhs) const {
 		//exit(-1);
 	}
 
-	const vector<int>& thatLow = rhs.get_lowest();
-	const vector<int>& thatHigh = rhs.get_highest();
+	const vector<coord_t>& thatLow = rhs.get_lowest();
+	const vector<coord_t>& thatHigh = rhs.get_highest();
 
 	//if the two shapes intersect, they must intersect in all dimensions.
 	for (int cIndex = 0; cIndex < this->get_dim(); cIndex++)
@@ -80,6 +81,14 @@ bool BoundingBox::is_intersected(const BoundingBox& rhs) const {
 	return true;
 }
 
+bool BoundingBox::contains(const BoundingBox& rhs) const {
+	for (int cIndex = 0; cIndex < this->get_dim(); cIndex++)
+	{
+		if (this->lowest[cIndex] > rhs.lowest[cIndex] || this->highest[cIndex] < rhs.highest[cIndex]) return false;
+	}
+	return true;
+}
+
 bool BoundingBox::is_valid() const {
 	for (int i = 0; i < this->get_dim(); i++)
 	{
@@ -122,8 +131,8 @@ void BoundingBox::group_with(const BoundingBox& rhs) {
 		//exit(-1);
 	};
 
-	const vector<int>& thatLow = rhs.get_lowest();
-	const vector<int>& thatHigh = rhs.get_highest();
+	const vector<coord_t>& thatLow = rhs.get_lowest();
+	const vector<coord_t>& thatHigh = rhs.get_highest();
 
 	for (int cIndex = 0; cIndex < this->get_dim(); cIndex++)
 	{
@@ -132,6 +141,48 @@ void BoundingBox::group_with(const BoundingBox& rhs) {
 	}
 }
 
+void BoundingBox::set_box(const coord_t* low, const coord_t* high, int dim) {
+	this->lowest.assign(low, low + dim);
+	this->highest.assign(high, high + dim);
+}
+
+bool BoundingBox::is_equal(const coord_t* low, const coord_t* high) const {
+	for (int cIndex = 0; cIndex < this->get_dim(); cIndex++)
+	{
+		if (this->lowest[cIndex] != low[cIndex] || this->highest[cIndex] != high[cIndex]) return false;
+	}
+	return true;
+}
+
+bool BoundingBox::is_intersected(const coord_t* low, const coord_t* high) const {
+	for (int cIndex = 0; cIndex < this->get_dim(); cIndex++)
+	{
+		if (this->lowest[cIndex] > high[cIndex] || this->highest[cIndex] < low[cIndex]) return false;
+	}
+	return true;
+}
+
+bool BoundingBox::contains(const coord_t* low, const coord_t* high) const {
+	for (int cIndex = 0; cIndex < this->get_dim(); cIndex++)
+	{
+		if (this->lowest[cIndex] > low[cIndex] || this->highest[cIndex] < high[cIndex]) return false;
+	}
+	return true;
+}
+
+bool BoundingBox::contains_point(const coord_t* coordinate) const {
+	for (int cIndex = 0; cIndex < this->get_dim(); cIndex++)
+	{
+		if (this->lowest[cIndex] > coordinate[cIndex] || this->highest[cIndex] < coordinate[cIndex]) return false;
+	}
+	return true;
+}
+
+void BoundingBox::swap(BoundingBox& rhs) {
+	this->lowest.swap(rhs.lowest);
+	this->highest.swap(rhs.highest);
+}
+
 void BoundingBox::set_boundingbox(const BoundingBox& rhs) {
 
 	this->lowest = rhs.get_lowest();
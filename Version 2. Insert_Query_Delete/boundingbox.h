@@ -4,30 +4,55 @@
 #include <vector>
 
 using namespace std;
-
+
+//coordinate type, chosen at build time (see Makefile): int by default,
+//long long with RTREE_COORD_INT64, float with RTREE_COORD_FLOAT, double with RTREE_COORD_DOUBLE.
+//areas and area enlargements are computed in area_t, whose range covers the product of dim sides.
+#if defined(RTREE_COORD_INT64)
+typedef long long coord_t;
+typedef long double area_t;
+#elif defined(RTREE_COORD_FLOAT)
+typedef float coord_t;
+typedef double area_t;
+#elif defined(RTREE_COORD_DOUBLE)
+typedef double coord_t;
+typedef long double area_t;
+#else
+typedef int coord_t;
+typedef double area_t;
+#endif
+
 
 class BoundingBox {
 private:
-	vector<int> lowest; //lowest coordinate of the bounding box
-	vector<int> highest; //highest coordinate
+	vector<coord_t> lowest; //lowest coordinate of the bounding box
+	vector<coord_t> highest; //highest coordinate
 public:
 	BoundingBox();
-	BoundingBox(vector<int> thatLow, vector<int> thatHigh);
+	BoundingBox(vector<coord_t> thatLow, vector<coord_t> thatHigh);
 	BoundingBox(const BoundingBox& thatBox);
 
-	const vector<int>& get_lowest() const;
-	const vector<int>& get_highest() const;
+	const vector<coord_t>& get_lowest() const;
+	const vector<coord_t>& get_highest() const;
 	int get_dim() const;
-	int get_area() const;
-	int get_lowestValue_at(const int index) const;
-	int get_highestValue_at(const int index) const;
+	area_t get_area() const;
+	coord_t get_lowestValue_at(const int index) const;
+	coord_t get_highestValue_at(const int index) const;
 
 	bool is_equal(const BoundingBox& rhs) const; // if this mbr equals to rhs mbr
 	bool is_intersected(const BoundingBox& rhs) const;// if this mbr overlaps with rhs mbr
+	bool contains(const BoundingBox& rhs) const; // if rhs mbr lies inside this mbr
 	bool is_valid() const;
 	void print() const;
 
 	void group_with(const BoundingBox& rhs); //update this by the MBR of this and rhs
 	void set_boundingbox(const BoundingBox& rhs);
+	void swap(BoundingBox& rhs); //exchange the coordinates without copying them
+	void set_box(const coord_t* low, const coord_t* high, int dim); //reusing the storage
+	bool contains_point(const coord_t* coordinate) const;
+	// the same tests against a box given by its corners
+	bool is_equal(const coord_t* low, const coord_t* high) const;
+	bool is_intersected(const coord_t* low, const coord_t* high) const;
+	bool contains(const coord_t* low, const coord_t* high) const;
 };
 
@@ -0,0 +1,49 @@
+#include "hilbert.h"
+
+//
+// Transform the coordinate into the transposed Hilbert index and interleave its bits.
+// See J. Skilling, "Programming the Hilbert curve", AIP Conf. Proc. 707, 2004.
+//
+unsigned long long hilbert_key(vector<unsigned int> coordinate, int bits)
+{
+	int dim = coordinate.size();
+	if (bits <= 0 || dim == 0)
+		return 0;
+
+	unsigned int M = 1U << (bits - 1);
+	unsigned int P, Q, t;
+
+	// inverse undo
+	for (Q = M; Q > 1; Q >>= 1) {
+		P = Q - 1;
+		for (int i = 0; i < dim; i++) {
+			if (coordinate[i] & Q)
+				coordinate[0] ^= P;
+			else {
+				t = (coordinate[0] ^ coordinate[i]) & P;
+				coordinate[0] ^= t;
+				coordinate[i] ^= t;
+			}
+		}
+	}
+
+	// gray encode
+	for (int i = 1; i < dim; i++)
+		coordinate[i] ^= coordinate[i-1];
+	t = 0;
+	for (Q = M; Q > 1; Q >>= 1) {
+		if (coordinate[dim-1] & Q)
+			t ^= Q - 1;
+	}
+	for (int i = 0; i < dim; i++)
+		coordinate[i] ^= t;
+
+	// the most significant bit of every dimension goes first
+	unsigned long long key = 0;
+	for (int b = bits - 1; b >= 0; b--) {
+		for (int i = 0; i < dim; i++) {
+			key = (key << 1) | ((coordinate[i] >> b) & 1);
+		}
+	}
+	return key;
+}
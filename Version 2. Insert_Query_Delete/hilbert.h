@@ -0,0 +1,7 @@
+#include <vector>
+
+using namespace std;
+
+// Position of a point on the Hilbert curve.
+// ``coordinate'' holds one non-negative value of ``bits'' bits per dimension, and dim * bits must not exceed 64.
+unsigned long long hilbert_key(vector<unsigned int> coordinate, int bits);
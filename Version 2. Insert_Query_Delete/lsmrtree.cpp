@@ -0,0 +1,450 @@
+/* Implementations of the log-structured R-tree */
+#include "lsmrtree.h"
+#include <algorithm>
+
+
+const int FILTER_BITS_PER_KEY = 10;
+const int FILTER_PROBES = 7;
+const double COMPACT_TOMBSTONES = 0.25; // share of its records a run may hold tombstones for before it is compacted
+
+
+//
+// The key of a record: its lowest, then its highest corner.
+//
+static vector<coord_t> record_key(const BoundingBox& mbr)
+{
+	vector<coord_t> key(mbr.get_lowest());
+	key.insert(key.end(), mbr.get_highest().begin(), mbr.get_highest().end());
+	return key;
+}
+
+
+//
+// Double hashing: probe i of ``key'' is h1 + i * h2, with both halves taken from one mixed hash.
+//
+static unsigned long long filter_hash(const vector<coord_t>& key)
+{
+	unsigned long long h = KeyHash()(key);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+KeyFilter::KeyFilter(int key_num)
+{
+	bit_num = (size_t)max(key_num, 1) * FILTER_BITS_PER_KEY;
+	bits.assign((bit_num + 63) / 64, 0);
+}
+
+void KeyFilter::add(const vector<coord_t>& key)
+{
+	unsigned long long h = filter_hash(key);
+	unsigned long long h1 = h & 0xffffffffULL, h2 = (h >> 32) | 1;
+	for (int i = 0; i < FILTER_PROBES; i++) {
+		size_t bit = (h1 + i * h2) % bit_num;
+		bits[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
+
+bool KeyFilter::may_contain(const vector<coord_t>& key) const
+{
+	unsigned long long h = filter_hash(key);
+	unsigned long long h1 = h & 0xffffffffULL, h2 = (h >> 32) | 1;
+	for (int i = 0; i < FILTER_PROBES; i++) {
+		size_t bit = (h1 + i * h2) % bit_num;
+		if (!(bits[bit / 64] & (1ULL << (bit % 64))))
+			return false;
+	}
+	return true;
+}
+
+
+LSMRTree::LSMRTree(int leaf_entry_num, int entry_num, int dim, int memtable_size, int merge_width)
+{
+	max_leaf_num = leaf_entry_num;
+	max_entry_num = entry_num;
+	dimension = dim;
+	this->memtable_size = max(memtable_size, 1);
+	this->merge_width = max(merge_width, 2);
+	memtable = new RTree(leaf_entry_num, entry_num, dim);
+	memtable_num = 0;
+	merge_busy = false;
+	stopping = false;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&work, NULL);
+	pthread_cond_init(&idle, NULL);
+	merger_started = pthread_create(&merger, NULL, run_merger, this) == 0;
+	if (!merger_started)
+		cerr << "Cannot start the merging thread, runs will not be merged\n";
+}
+
+LSMRTree::~LSMRTree()
+{
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+	if (merger_started)
+		pthread_join(merger, NULL);
+	pthread_cond_destroy(&idle);
+	pthread_cond_destroy(&work);
+	pthread_mutex_destroy(&lock);
+	delete memtable;
+	for (int i = 0; i < runs.size(); i++) {
+		delete runs[i]->tree;
+		delete runs[i]->deleted;
+		delete runs[i];
+	}
+}
+
+
+//
+// Make a run of ``level'' holding ``records''.
+//
+LSMRun* LSMRTree::build_run(const vector<Entry>& records, int level)
+{
+	LSMRun* run = new LSMRun(records.size());
+	run->tree = new RTree(max_leaf_num, max_entry_num, dimension);
+	run->tree->bulk_load(records);
+	for (int i = 0; i < records.size(); i++) {
+		run->filter.add(record_key(records[i].get_mbr()));
+	}
+	run->deleted = NULL;
+	run->record_num = records.size();
+	run->level = level;
+	run->merging = false;
+	return run;
+}
+
+
+//
+// Return the index of the run holding the live record with the MBR ``mbr'' and key ``key'', or -1.
+// The filter of a run spares the search of most runs without it.
+//
+int LSMRTree::find_run(const BoundingBox& mbr, const vector<coord_t>& key)
+{
+	vector<Entry> found;
+	for (int i = runs.size() - 1; i >= 0; i--) {
+		LSMRun* run = runs[i];
+		if (!run->filter.may_contain(key) || run->deleted_keys.count(key) > 0)
+			continue;
+		found.clear();
+		run->tree->query_range(mbr, found, CONTAINED_IN);
+		for (int k = 0; k < found.size(); k++) {
+			if (found[k].get_mbr().is_equal(mbr))
+				return i;
+		}
+	}
+	return -1;
+}
+
+
+//
+// Turn the memtable into a run of level 0 and wake the merging thread. The lock must be held.
+//
+void LSMRTree::flush_memtable()
+{
+	if (memtable_num == 0)
+		return;
+	vector<Entry> records;
+	memtable->get_records(records);
+	delete memtable;
+	memtable = new RTree(max_leaf_num, max_entry_num, dimension);
+	memtable_num = 0;
+	runs.push_back(build_run(records, 0));
+	pthread_cond_signal(&work);
+}
+
+
+//
+// Return the lowest level with ``merge_width'' runs not being merged, or -1. The lock must be held.
+//
+int LSMRTree::merge_level()
+{
+	vector<int> cnt;
+	for (int i = 0; i < runs.size(); i++) {
+		if (runs[i]->merging)
+			continue;
+		if (runs[i]->level >= cnt.size())
+			cnt.resize(runs[i]->level + 1, 0);
+		cnt[runs[i]->level]++;
+	}
+	for (int level = 0; level < cnt.size(); level++) {
+		if (cnt[level] >= merge_width)
+			return level;
+	}
+	return -1;
+}
+
+
+//
+// Return the index of a run not being merged with COMPACT_TOMBSTONES of its records deleted, or -1.
+// The lock must be held.
+//
+int LSMRTree::compact_run()
+{
+	for (int i = 0; i < runs.size(); i++) {
+		LSMRun* run = runs[i];
+		if (!run->merging && !run->deleted_keys.empty() && run->deleted_keys.size() >= COMPACT_TOMBSTONES * run->record_num)
+			return i;
+	}
+	return -1;
+}
+
+
+//
+// Body of the merging thread. It takes the oldest ``merge_width'' runs of the lowest level that has
+// that many, reads their records without the lock, leaving out those with a tombstone, and
+// bulk-loads the rest into a run of the next level. Under the lock again, tombstones added
+// meanwhile are carried over to the new run, which then replaces the merged ones. With no merge
+// due, a run with many tombstones is compacted the same way, alone and into its own level; a run
+// left without records is dropped.
+//
+void LSMRTree::merge_runs()
+{
+	pthread_mutex_lock(&lock);
+	while (!stopping) {
+		int level = merge_level();
+		int compacted = level < 0 ? compact_run() : -1;
+		if (level < 0 && compacted < 0) {
+			merge_busy = false;
+			pthread_cond_broadcast(&idle);
+			pthread_cond_wait(&work, &lock);
+			continue;
+		}
+		merge_busy = true;
+		vector<LSMRun*> group;
+		if (compacted >= 0) {
+			runs[compacted]->merging = true;
+			group.push_back(runs[compacted]);
+		}
+		for (int i = 0; i < runs.size() && group.size() < merge_width && compacted < 0; i++) {
+			if (!runs[i]->merging && runs[i]->level == level) {
+				runs[i]->merging = true;
+				group.push_back(runs[i]);
+			}
+		}
+		vector<unordered_set<vector<coord_t>, KeyHash> > dropped(group.size());
+		for (int k = 0; k < group.size(); k++) {
+			dropped[k] = group[k]->deleted_keys;
+		}
+		pthread_mutex_unlock(&lock);
+
+		vector<Entry> records, part;
+		for (int k = 0; k < group.size(); k++) {
+			part.clear();
+			group[k]->tree->get_records(part);
+			for (int i = 0; i < part.size(); i++) {
+				if (dropped[k].count(record_key(part[i].get_mbr())) == 0)
+					records.push_back(part[i]);
+			}
+		}
+		LSMRun* merged = build_run(records, compacted >= 0 ? group[0]->level : level + 1);
+
+		pthread_mutex_lock(&lock);
+		for (int k = 0; k < group.size(); k++) {
+			if (group[k]->deleted == NULL)
+				continue;
+			part.clear();
+			group[k]->deleted->get_records(part);
+			for (int i = 0; i < part.size(); i++) {
+				vector<coord_t> key = record_key(part[i].get_mbr());
+				if (dropped[k].count(key) > 0)
+					continue;
+				if (merged->deleted == NULL)
+					merged->deleted = new RTree(max_leaf_num, max_entry_num, dimension);
+				merged->deleted->insert(part[i].get_mbr(), part[i].get_rid());
+				merged->deleted_keys.insert(key);
+			}
+		}
+		vector<LSMRun*> kept;
+		for (int i = 0; i < runs.size(); i++) {
+			if (runs[i] == group[0] && merged->record_num > 0)
+				kept.push_back(merged);
+			else if (find(group.begin(), group.end(), runs[i]) == group.end())
+				kept.push_back(runs[i]);
+		}
+		runs.swap(kept);
+		if (merged->record_num == 0) {
+			delete merged->tree;
+			delete merged;
+		}
+		for (int k = 0; k < group.size(); k++) {
+			delete group[k]->tree;
+			delete group[k]->deleted;
+			delete group[k];
+		}
+	}
+	merge_busy = false;
+	pthread_cond_broadcast(&idle);
+	pthread_mutex_unlock(&lock);
+}
+
+void* LSMRTree::run_merger(void* arg)
+{
+	((LSMRTree*)arg)->merge_runs();
+	return NULL;
+}
+
+
+//
+// Insert a record, unless a record with the same key is in the store.
+// A full memtable is flushed into a run.
+//
+bool LSMRTree::insert(const vector<coord_t>& coordinate, int rid)
+{
+	BoundingBox mbr(coordinate, coordinate);
+	return insert(mbr, rid);
+}
+
+bool LSMRTree::insert(const BoundingBox& mbr, int rid)
+{
+	if (mbr.get_dim() != dimension) {
+		cerr << "R-tree dimensionality inconsistency\n";
+		return false;
+	}
+	if (!mbr.is_valid())
+		return false;
+	pthread_mutex_lock(&lock);
+	bool inserted = find_run(mbr, record_key(mbr)) < 0 && memtable->insert(mbr, rid);
+	if (inserted && ++memtable_num >= memtable_size)
+		flush_memtable();
+	pthread_mutex_unlock(&lock);
+	return inserted;
+}
+
+
+//
+// Delete the record with exactly the MBR ``mbr'': from the memtable if it is there, otherwise by a
+// tombstone in the run holding it.
+// Return true if the record was found.
+//
+bool LSMRTree::del(const vector<coord_t>& coordinate)
+{
+	BoundingBox mbr(coordinate, coordinate);
+	return del(mbr);
+}
+
+bool LSMRTree::del(const BoundingBox& mbr)
+{
+	if (mbr.get_dim() != dimension) {
+		cerr << "R-tree dimensionality inconsistency\n";
+		return false;
+	}
+	pthread_mutex_lock(&lock);
+	bool found = memtable->del(mbr);
+	if (found) {
+		memtable_num--;
+	}
+	else {
+		vector<coord_t> key = record_key(mbr);
+		int i = find_run(mbr, key);
+		if (i >= 0) {
+			LSMRun* run = runs[i];
+			if (run->deleted == NULL)
+				run->deleted = new RTree(max_leaf_num, max_entry_num, dimension);
+			run->deleted->insert(mbr, 0);
+			run->deleted_keys.insert(key);
+			found = true;
+			if (run->deleted_keys.size() >= COMPACT_TOMBSTONES * run->record_num)
+				pthread_cond_signal(&work);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return found;
+}
+
+
+//
+// Range query over all the components, see RTree::query_range().
+// A tombstone has the MBR of the record it deletes, so a run contributes its matching records less
+// its matching tombstones. Nodes of the tombstone trees count as visited nodes.
+//
+void LSMRTree::query_range(const BoundingBox& mbr, int& result_count, int& node_travelled, RangePredicate pred)
+{
+	pthread_mutex_lock(&lock);
+	memtable->query_range(mbr, result_count, node_travelled, pred);
+	for (int i = 0; i < runs.size(); i++) {
+		int cnt = 0, nodes = 0;
+		runs[i]->tree->query_range(mbr, cnt, nodes, pred);
+		result_count += cnt;
+		node_travelled += nodes;
+		if (runs[i]->deleted != NULL) {
+			runs[i]->deleted->query_range(mbr, cnt, nodes, pred);
+			result_count -= cnt;
+			node_travelled += nodes;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+
+//
+// Point query over all the components, newest first, see RTree::query_point().
+//
+bool LSMRTree::query_point(const vector<coord_t>& coordinate, Entry& result)
+{
+	pthread_mutex_lock(&lock);
+	bool found = memtable->query_point(coordinate, result);
+	BoundingBox mbr(coordinate, coordinate);
+	vector<Entry> records;
+	for (int i = runs.size() - 1; i >= 0 && !found; i--) {
+		records.clear();
+		runs[i]->tree->query_range(mbr, records);
+		for (int k = 0; k < records.size() && !found; k++) {
+			if (runs[i]->deleted_keys.count(record_key(records[k].get_mbr())) == 0) {
+				result = records[k];
+				found = true;
+			}
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return found;
+}
+
+
+//
+// Flush the memtable into a run, even if it is not full.
+//
+void LSMRTree::flush()
+{
+	pthread_mutex_lock(&lock);
+	flush_memtable();
+	pthread_mutex_unlock(&lock);
+}
+
+
+//
+// Wait until the merging thread has done every merge and compaction due.
+//
+void LSMRTree::wait_merges()
+{
+	pthread_mutex_lock(&lock);
+	while (merger_started && (merge_busy || merge_level() >= 0 || compact_run() >= 0))
+		pthread_cond_wait(&idle, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+
+void LSMRTree::stat()
+{
+	pthread_mutex_lock(&lock);
+	int record_cnt = memtable_num, tombstone_cnt = 0;
+	for (int i = 0; i < runs.size(); i++) {
+		record_cnt += runs[i]->record_num - runs[i]->deleted_keys.size();
+		tombstone_cnt += runs[i]->deleted_keys.size();
+	}
+	cout << "Records in the memtable: " << memtable_num << endl;
+	cout << "Number of runs: " << runs.size() << endl;
+	for (int i = 0; i < runs.size(); i++) {
+		cout << "  Run " << i << ": level " << runs[i]->level << ", " << runs[i]->record_num << " records, "
+			<< runs[i]->deleted_keys.size() << " tombstones" << endl;
+	}
+	cout << "Number of records: " << record_cnt << endl;
+	cout << "Number of tombstones: " << tombstone_cnt << endl;
+	cout << "Dimension: " << dimension << endl;
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,87 @@
+/* Definitions of the log-structured R-tree */
+
+#include "rtree.h"
+#include <pthread.h>
+
+// Bloom filter over record keys: may_contain() is false for a key that was never added, and true
+// for one that was. Sized for about 1% of false positives.
+class KeyFilter {
+	public:
+		KeyFilter(int key_num);
+		void add(const vector<coord_t>& key);
+		bool may_contain(const vector<coord_t>& key) const;
+
+	private:
+		vector<unsigned long long> bits;
+		size_t bit_num;
+};
+
+// An immutable component of an LSMRTree: records bulk-loaded into a packed R-tree, and the
+// tombstones of those deleted since.
+struct LSMRun {
+	LSMRun(int key_num) : filter(key_num) {}
+
+	RTree* tree;		// the records, never modified once loaded
+	int record_num;		// records in ``tree''
+	KeyFilter filter;	// keys of the records
+	RTree* deleted;		// the deleted records, NULL if none
+	unordered_set<vector<coord_t>, KeyHash> deleted_keys;
+	int level;			// 0 if flushed from the memtable, else one more than the runs merged into it
+	bool merging;		// whether a merge is reading the run
+};
+
+//
+// Record store in the manner of a log-structured merge tree, for write-heavy workloads.
+// Records are inserted into a small mutable R-tree, the memtable. A full memtable is bulk-loaded
+// into an immutable packed R-tree, a run, and a background thread merges ``merge_width'' runs of
+// the same level into one of the next level (tiered merging), so there are few runs for queries to
+// visit. A record of a run is deleted by a tombstone, dropped with the record by the next merge, or
+// by compacting the run alone once its tombstones reach a share of its records (a run of the top
+// level may never be merged again).
+// Queries visit every component and merge their results; keys are unique across the store.
+//
+class LSMRTree {
+	public:
+		LSMRTree(int leaf_entry_num, int entry_num, int dim, int memtable_size, int merge_width = 4);
+		~LSMRTree();
+
+	private:
+		LSMRun* build_run(const vector<Entry>& records, int level);
+		int find_run(const BoundingBox& mbr, const vector<coord_t>& key);
+		void flush_memtable();
+		int merge_level();
+		int compact_run();
+		void merge_runs();
+		static void* run_merger(void* arg);
+
+	public:
+		bool insert(const vector<coord_t>& coordinate, int rid);
+		bool insert(const BoundingBox& mbr, int rid);
+		bool del(const vector<coord_t>& coordinate);
+		bool del(const BoundingBox& mbr);
+		void query_range(const BoundingBox& mbr, int& result_count, int& node_travelled, RangePredicate pred = INTERSECTS);
+		bool query_point(const vector<coord_t>& coordinate, Entry& result);
+		void flush();
+		void wait_merges();
+		void stat();
+
+	private:
+		int max_leaf_num;		// node capacities of the trees of all components
+		int max_entry_num;
+		int dimension;
+		int memtable_size;		// records of a full memtable
+		int merge_width;		// runs merged at once
+
+		RTree* memtable;
+		int memtable_num;		// records in the memtable
+		vector<LSMRun*> runs;	// oldest first
+
+		// the merging thread; ``lock'' guards the components against it
+		pthread_t merger;
+		bool merger_started;
+		pthread_mutex_t lock;
+		pthread_cond_t work;	// signalled when a run is added, or on destruction
+		pthread_cond_t idle;	// signalled when the merging thread runs out of merges
+		bool merge_busy;
+		bool stopping;
+};
@@ -1,11 +1,45 @@
 #include <cstdlib>
 #include <fstream>
+#include <limits>
 #include "rtree.h"
+#include "shardedrtree.h"
+#include "lsmrtree.h"
+#include "replicatedrtree.h"
 
 using namespace std;
 
 const int MAX_CMD_LEN = 256;
+const int MAX_ARG_NUM = 256; // limit to at most 256 arguments
 const int DOMAIN_SIZE = 10000;
+const int CALIBRATION_SAMPLE = 10000; // random points inserted per candidate tree
+const int CALIBRATION_QUERIES = 1000; // random range queries per candidate tree
+
+// Parse a coordinate of the configured coordinate type (see boundingbox.h).
+coord_t parse_coord(const char* arg)
+{
+	if (numeric_limits<coord_t>::is_integer)
+		return (coord_t)strtoll(arg, NULL, 10);
+	return (coord_t)strtod(arg, NULL);
+}
+
+// A random point of the domain, drawn with rand() one coordinate at a time.
+vector<coord_t> random_point(int dimension)
+{
+	vector<coord_t> coordinate;
+	for (int j = 0; j < dimension; j++)
+		coordinate.push_back(rand() % DOMAIN_SIZE);
+	return coordinate;
+}
+
+// A random range of the given side, its lowest corner drawn as by random_point().
+BoundingBox random_range(int dimension, coord_t side)
+{
+	vector<coord_t> lowest = random_point(dimension);
+	vector<coord_t> highest;
+	for (int j = 0; j < dimension; j++)
+		highest.push_back(lowest[j] + side);
+	return BoundingBox(lowest, highest);
+}
 
 void help()
 {
@@ -14,11 +48,39 @@ void help()
 	cout << "============================================================================\n";
 	cout << "i x1(int) x2(int) ... xd(int) rid(int) : insert a record with d-dimension key (x1, x2,... , xd) and record id rid\n";
 	cout << "d x1(int) x2(int) ... xd(int) : delete the record with key (x1, x2,... , xd)\n";
+	cout << "dr x1min(int) x1max(int) ... xdmin(int) xdmax(int) : delete all records intersecting the range\n";
+	cout << "u x1(int) ... xd(int) y1(int) ... yd(int) : move the record with key (x1, ... , xd) to key (y1, ... , yd)\n";
+	cout << "ib x1min(int) x1max(int) ... xdmin(int) xdmax(int) rid(int) : insert a rectangle record with record id rid\n";
+	cout << "db x1min(int) x1max(int) ... xdmin(int) xdmax(int) : delete the rectangle record equal to the given one\n";
 	cout << "ri s(int) num(int) : random insertions of num records with seed s\n";
 	cout << "rd s(int) num(int) : random deletions of num records with seed s\n";
+	cout << "rq s(int) num(int) : random point queries of num keys with seed s, answered as a batch,\n";
+	cout << "     interleaved on a frozen tree\n";
 	cout << "qp x1(int) x2(int) ... xd(int) : query the record with key (x1, x2, ... , xd)\n";
 	cout << "qr x1min(int) x1max(int) x2min(int) x2max(int) ... xdmin(int) xdmax(int) : find records inside range\n";
 	cout << "     where ximin<=xi<=ximax\n";
+	cout << "j s(int) num(int) dist [threads(int)] : join the tree with num random records of seed s (as for ri),\n";
+	cout << "     pairing records within distance dist, or intersecting ones if dist is 0; in parallel with threads\n";
+	cout << "qs s(int) num(int) side(int) : num random range queries of the given side with seed s,\n";
+	cout << "     answered together by a shared traversal\n";
+	cout << "qd x1(int) x2(int) ... xd(int) r [l1|l2|linf] : find records within distance r of (x1, x2, ... , xd),\n";
+	cout << "     in the given metric (l2 by default)\n";
+	cout << "qc x1min(int) x1max(int) x2min(int) x2max(int) ... xdmin(int) xdmax(int) : find records contained in range\n";
+	cout << "qe x1min(int) x1max(int) x2min(int) x2max(int) ... xdmin(int) xdmax(int) : estimate the results and nodes\n";
+	cout << "     visited of 'qr' on the range without running it\n";
+	cout << "fb [bits(int)] : freeze the tree into a breadth-first array for fast queries\n";
+	cout << "fv [bits(int)] : freeze the tree into a van Emde Boas ordered array for fast queries\n";
+	cout << "     with bits (8 or 16), child MBRs of internal nodes are stored quantized and the internal\n";
+	cout << "     levels are rebuilt wider in the same cache lines: a lower tree and a smaller array, not\n";
+	cout << "     faster queries while the array fits in cache\n";
+	cout << "t : thaw a frozen tree (updates thaw it as well)\n";
+	cout << "rp : publish the frozen tree to a replica on every NUMA node; updates reach the replicas\n";
+	cout << "     only with the next 'rp'\n";
+	cout << "qn x1min(int) x1max(int) ... xdmin(int) xdmax(int) : 'qr' on the replica of the NUMA node of the driver\n";
+	cout << "bu c(int) : buffer insertions, c records per non-leaf node, pushed down in batches; 0 flushes and stops\n";
+	cout << "pb c(int) : simulate a buffer of c pages (LRU) under the queries, one page per node, and report\n";
+	cout << "     their page reads from now on; 0 stops; without c, print the page reads so far\n";
+	cout << "sk : skyline query, the records not dominated by another one (smaller is better)\n";
 	cout << "s : print the statistic information of the tree\n";
 	cout << "p : print the tree\n";
 	cout << "h : show this help menu\n";
@@ -26,24 +88,73 @@ void help()
 	cout << "============================================================================\n";
 }
 
+// Print a record as ``Record: <x1, ..., xd, rid>'', with the highest corner too for a rectangle.
+void print_record(const Entry& record)
+{
+	cout << "Record: <";
+	const BoundingBox& mbr = record.get_mbr();
+	for (int i = 0; i < mbr.get_dim(); i++)
+	{
+		cout << mbr.get_lowestValue_at(i);
+		if (i != mbr.get_dim() - 1)
+		{
+			cout << ", ";
+		}
+	}
+	if (!mbr.is_equal(&mbr.get_lowest()[0], &mbr.get_lowest()[0])) { // a rectangle record
+		for (int i = 0; i < mbr.get_dim(); i++)
+		{
+			cout << ", " << mbr.get_highestValue_at(i);
+		}
+	}
+	cout << ", " << record.get_rid()  << ">\n";
+}
+
+// The page accesses counted so far, none if the tree does not simulate a page buffer (see 'pb').
+PageStats page_stats(const RTree& tree)
+{
+	PageStats stats = { 0, 0 };
+	if (tree.get_page_buffer() != NULL)
+		stats = tree.get_page_buffer()->get_stats();
+	return stats;
+}
+
+// Print the page reads since ``before'' if the tree simulates a page buffer.
+void print_page_reads(const RTree& tree, const PageStats& before)
+{
+	if (tree.get_page_buffer() == NULL)
+		return;
+	PageStats after = page_stats(tree);
+	long long accesses = after.accesses - before.accesses;
+	long long reads = after.reads - before.reads;
+	cout << "Number of page reads: " << reads << " of " << accesses << " page accesses";
+	if (accesses > 0)
+		cout << ", hit ratio " << (double)(accesses - reads) / accesses;
+	cout << endl;
+}
+
 void error(const char* cmd)
 {
 	cerr << "Error: " << cmd << endl;
 }
 
-bool process(char* cmd, RTree& tree, int dimension)
+// The replicas the tree is published to by 'rp', made on first use.
+ReplicatedRTree& replicas()
+{
+	static ReplicatedRTree store;
+	return store;
+}
+
+// Split a command into its arguments. Return their number, or 0 when the command is invalid.
+int split_command(char* cmd, char* args[], int dimension)
 {
-	
-	const int MAX_ARG_NUM = 256; // limit to at most 256 arguments
-	char* args[MAX_ARG_NUM];
-	
 	char msg[1024]; // error message.
-	int actualMaxArgNum = 1 + dimension * 2;
+	int actualMaxArgNum = 2 + dimension * 2;
 	if (actualMaxArgNum > MAX_ARG_NUM)
 	{
 		sprintf(msg, "Too many command arguments");
 		error(msg);
-		return true;
+		return 0;
 	}
 	int num_arg = 0;
 	char* token = strtok(cmd, "\n \t");
@@ -54,8 +165,20 @@ bool process(char* cmd, RTree& tree, int dimension)
 	if (num_arg == 0 || token != NULL) {
 		sprintf(msg, "Wrong number of command arguments");
 		error(msg);
-		return true;
+		return 0;
 	}
+	return num_arg;
+}
+
+bool process(char* cmd, RTree& tree, int dimension)
+{
+	
+	char* args[MAX_ARG_NUM];
+	
+	char msg[1024]; // error message.
+	int num_arg = split_command(cmd, args, dimension);
+	if (num_arg == 0)
+		return true;
 	if (strcmp(args[0], "i") == 0) { // insertion.
 		if (num_arg != dimension + 2) {
 			sprintf(msg, "Wrong number of arguments for command 'i'");
@@ -63,10 +186,10 @@ bool process(char* cmd, RTree& tree, int dimension)
 		}
 		else {
 			//insert a point, modelled by a bounding box
-			vector<int> coordinate;
+			vector<coord_t> coordinate;
 			for (int i = 0; i < dimension; i++)
 			{
-				int coord = atoi(args[i + 1]);
+				coord_t coord = parse_coord(args[i + 1]);
 				coordinate.push_back(coord);
 			}
 			int rid = atoi(args[dimension + 1]);
@@ -89,10 +212,10 @@ bool process(char* cmd, RTree& tree, int dimension)
 			error(msg);
 		}
 		else {
-			vector<int> coordinate;
+			vector<coord_t> coordinate;
 			for (int i = 0; i < dimension; i++)
 			{
-				int coord = atoi(args[i + 1]);
+				coord_t coord = parse_coord(args[i + 1]);
 				coordinate.push_back(coord);
 			}
 
@@ -103,6 +226,93 @@ bool process(char* cmd, RTree& tree, int dimension)
 		}
 		return true;
 	}
+	else if (strcmp(args[0], "dr") == 0) { // range deletion.
+		if (num_arg != 1 + dimension * 2) {
+			sprintf(msg, "Wrong number of arguments for command 'dr'");
+			error(msg);
+		}
+		else {
+			vector<coord_t> lowest;
+			vector<coord_t> highest;
+			for (int i = 0; i < dimension; i++)
+			{
+				lowest.push_back(parse_coord(args[1 + i*2]));
+				highest.push_back(parse_coord(args[2 + i*2]));
+			}
+
+			BoundingBox mbr(lowest, highest);
+			cout << "Number of records deleted: " << tree.del_range(mbr) << endl;
+		}
+		return true;
+	}
+	else if (strcmp(args[0], "u") == 0) { // move a point record.
+		if (num_arg != dimension * 2 + 1) {
+			sprintf(msg, "Wrong number of arguments for command 'u'");
+			error(msg);
+		}
+		else {
+			vector<coord_t> old_coord, new_coord;
+			for (int i = 0; i < dimension; i++)
+			{
+				old_coord.push_back(parse_coord(args[i + 1]));
+				new_coord.push_back(parse_coord(args[dimension + i + 1]));
+			}
+
+			if (tree.update(old_coord, new_coord))
+				cout << "Update done.\n";
+			else
+				cout << "Update failed.\n";
+		}
+		return true;
+	}
+	else if (strcmp(args[0], "ib") == 0) { // rectangle insertion.
+		if (num_arg != 2 + dimension * 2) {
+			sprintf(msg, "Wrong number of arguments for command 'ib'");
+			error(msg);
+		}
+		else {
+			vector<coord_t> lowest;
+			vector<coord_t> highest;
+			for (int i = 0; i < dimension; i++)
+			{
+				lowest.push_back(parse_coord(args[1 + i*2]));
+				highest.push_back(parse_coord(args[2 + i*2]));
+			}
+			int rid = atoi(args[1 + dimension * 2]);
+			try {
+				if (tree.insert(BoundingBox(lowest, highest), rid))
+					cout << "Insertion done.\n";
+				else
+					cout << "Insertion failed.\n";
+			}
+			catch (bad_alloc& ba)  {
+				sprintf(msg, "bad_alloc caught <%s> ", ba.what());
+				error(msg);
+			}
+		}
+		return true;
+	}
+	else if (strcmp(args[0], "db") == 0) { // rectangle deletion.
+		if (num_arg != 1 + dimension * 2) {
+			sprintf(msg, "Wrong number of arguments for command 'db'");
+			error(msg);
+		}
+		else {
+			vector<coord_t> lowest;
+			vector<coord_t> highest;
+			for (int i = 0; i < dimension; i++)
+			{
+				lowest.push_back(parse_coord(args[1 + i*2]));
+				highest.push_back(parse_coord(args[2 + i*2]));
+			}
+
+			if (tree.del(BoundingBox(lowest, highest)))
+				cout << "Deletion done.\n";
+			else
+				cout << "Deletion failed.\n";
+		}
+		return true;
+	}
 	else if (strcmp(args[0], "ri") == 0) { // random insertion.
 		if (num_arg != 3) {
 			sprintf(msg, "Wrong number of arguments for command 'ri'");
@@ -112,25 +322,18 @@ bool process(char* cmd, RTree& tree, int dimension)
 			srand(atoi(args[1]));
 			int num = atoi(args[2]);
 			int succeed = 0;
+			vector<vector<coord_t> > coordinates;
+			vector<int> rids;
 			for (int i = 0; i < num; i++) {
-				vector<int> coordinate;
-				for (int j = 0; j < dimension; j++)
-				{
-					int coord = rand() % DOMAIN_SIZE;
-					coordinate.push_back(coord);
-				}
-				int rid = rand();
-				
-				try {
-					if (tree.insert(coordinate, rid)) {
-						succeed++;
-					}
-				}
-				catch (bad_alloc& ba)  {
-					sprintf(msg, "bad_alloc caught <%s> ", ba.what());
-					error(msg);
-				}
-				//tree.print_tree();
+				coordinates.push_back(random_point(dimension));
+				rids.push_back(rand());
+			}
+			try {
+				succeed = tree.insert_batch(coordinates, rids);
+			}
+			catch (bad_alloc& ba)  {
+				sprintf(msg, "bad_alloc caught <%s> ", ba.what());
+				error(msg);
 			}
 			cout << succeed << " out of " << num << " insertion(s) suceeded.\n";
 		}
@@ -146,7 +349,7 @@ bool process(char* cmd, RTree& tree, int dimension)
 			int num = atoi(args[2]);
 			int succeed = 0;
 			for (int i = 0; i < num; i++) {
-				vector<int> coordinate;
+				vector<coord_t> coordinate;
 				for (int j = 0; j < dimension; j++)
 				{
 					int coord = rand() % DOMAIN_SIZE;
@@ -161,30 +364,135 @@ bool process(char* cmd, RTree& tree, int dimension)
 		}
 		return true;
 	}
-	else if (strcmp(args[0], "qr") == 0) { // range query.
+	else if (strcmp(args[0], "rq") == 0) { // random point queries.
+		if (num_arg != 3) {
+			sprintf(msg, "Wrong number of arguments for command 'rq'");
+			error(msg);
+		}
+		else {
+			srand(atoi(args[1]));
+			int num = atoi(args[2]);
+			vector<vector<coord_t> > coordinates;
+			for (int i = 0; i < num; i++) {
+				coordinates.push_back(random_point(dimension));
+				(void)rand(); // to be compatible with ``ri''.
+			}
+			vector<Entry> results;
+			vector<bool> found;
+			PageStats pages = page_stats(tree);
+			int succeed = tree.query_point_batch(coordinates, results, found);
+			cout << succeed << " out of " << num << " point query(ies) found a record.\n";
+			print_page_reads(tree, pages);
+		}
+		return true;
+	}
+	else if (strcmp(args[0], "j") == 0) { // spatial join with random records.
+		if (num_arg != 4 && num_arg != 5) {
+			sprintf(msg, "Wrong number of arguments for command 'j'");
+			error(msg);
+		}
+		else {
+			srand(atoi(args[1]));
+			int num = atoi(args[2]);
+			double distance = atof(args[3]);
+			vector<vector<coord_t> > coordinates;
+			vector<int> rids;
+			for (int i = 0; i < num; i++) {
+				coordinates.push_back(random_point(dimension));
+				rids.push_back(rand());
+			}
+			NodeCapacity capacity = tree.capacity();
+			RTree other(capacity.leaf, capacity.internal, dimension);
+			long long pair_count = 0;
+			int node_travelled = 0;
+			try {
+				other.insert_batch(coordinates, rids);
+				JoinPredicate pred = distance > 0 ? JOIN_WITHIN_DISTANCE : JOIN_INTERSECTS;
+				if (num_arg == 5)
+					tree.join_parallel(other, pred, distance, NULL, pair_count, node_travelled, atoi(args[4]));
+				else
+					tree.join(other, pred, distance, NULL, pair_count, node_travelled);
+			}
+			catch (bad_alloc& ba)  {
+				sprintf(msg, "bad_alloc caught <%s> ", ba.what());
+				error(msg);
+			}
+			cout << "Number of pairs: " << pair_count << endl;
+			cout << "Number of node pairs visited: " << node_travelled << endl;
+		}
+		return true;
+	}
+	else if (strcmp(args[0], "qr") == 0 || strcmp(args[0], "qc") == 0) { // range query.
 		if (num_arg != 1 + dimension * 2) {
-			sprintf(msg, "Wrong number of arguments for command 'qr'");
+			sprintf(msg, "Wrong number of arguments for command '%s'", args[0]);
 			error(msg);
 		}
 		else {
-			vector<int> lowest;
-			vector<int> highest;
+			vector<coord_t> lowest;
+			vector<coord_t> highest;
 			for (int i = 0; i < dimension; i++)
 			{
-				lowest.push_back(atoi(args[1 + i*2]));			
-				highest.push_back(atoi(args[2 + i*2]));
+				lowest.push_back(parse_coord(args[1 + i*2]));			
+				highest.push_back(parse_coord(args[2 + i*2]));
 			}
 
 			BoundingBox mbr(lowest, highest);
 
 			int result_count = 0;
 			int node_travelled = 0;
-			tree.query_range(mbr, result_count, node_travelled);
+			PageStats pages = page_stats(tree);
+			tree.query_range(mbr, result_count, node_travelled, strcmp(args[0], "qc") == 0 ? CONTAINED_IN : INTERSECTS);
+			cout << "Number of results: " << result_count << endl;
+			cout << "Number of nodes visited: " << node_travelled << endl;
+			print_page_reads(tree, pages);
+		}
+		return true;
+	}
+	else if (strcmp(args[0], "qn") == 0) { // range query of a replica.
+		if (num_arg != 1 + dimension * 2) {
+			sprintf(msg, "Wrong number of arguments for command 'qn'");
+			error(msg);
+		}
+		else {
+			vector<coord_t> lowest;
+			vector<coord_t> highest;
+			for (int i = 0; i < dimension; i++)
+			{
+				lowest.push_back(parse_coord(args[1 + i*2]));
+				highest.push_back(parse_coord(args[2 + i*2]));
+			}
+
+			int result_count = 0;
+			int node_travelled = 0;
+			QueryScratch scratch;
+			ReplicatedRTree& store = replicas();
+			store.query_range(store.current_node(), BoundingBox(lowest, highest), result_count, node_travelled, INTERSECTS, scratch);
 			cout << "Number of results: " << result_count << endl;
 			cout << "Number of nodes visited: " << node_travelled << endl;
 		}
 		return true;
 	}
+	else if (strcmp(args[0], "qe") == 0) { // range query estimate.
+		if (num_arg != 1 + dimension * 2) {
+			sprintf(msg, "Wrong number of arguments for command 'qe'");
+			error(msg);
+		}
+		else {
+			vector<coord_t> lowest;
+			vector<coord_t> highest;
+			for (int i = 0; i < dimension; i++)
+			{
+				lowest.push_back(parse_coord(args[1 + i*2]));
+				highest.push_back(parse_coord(args[2 + i*2]));
+			}
+			double result_count = 0;
+			int node_travelled = 0;
+			tree.estimate_range(BoundingBox(lowest, highest), result_count, node_travelled);
+			cout << "Estimated number of results: " << result_count << endl;
+			cout << "Estimated number of nodes visited: " << node_travelled << endl;
+		}
+		return true;
+	}
 	else if (strcmp(args[0], "qp") == 0) { // point query.
 		if (num_arg != 1 + dimension) {
 			sprintf(msg, "Wrong number of arguments for command 'qp'");
@@ -193,37 +501,161 @@ bool process(char* cmd, RTree& tree, int dimension)
 		else {
 			Entry result;
 
-			vector<int> coordinate;
+			vector<coord_t> coordinate;
 
 			for (int i = 0; i < dimension; i++)
 			{
-				coordinate.push_back(atoi(args[i + 1]));
+				coordinate.push_back(parse_coord(args[i + 1]));
 			}
 
+			PageStats pages = page_stats(tree);
 			if (tree.query_point(coordinate, result)) {
-				cout << "Record: <";
-				BoundingBox resultP = result.get_mbr();
-				for (int i = 0; i < resultP.get_dim(); i++)
-				{
-					cout << resultP.get_lowestValue_at(i);
-					if (i != resultP.get_dim() - 1)
-					{
-						cout << ", ";
-					}
-				}
-				cout << ", " << result.get_rid()  << ">\n";
+				print_record(result);
 			}
 			else {
 				cout << "Record not found.\n";
 			}
+			print_page_reads(tree, pages);
+		}
+		return true;
+	}
+	else if (strcmp(args[0], "qs") == 0) { // random range queries with a shared traversal.
+		if (num_arg != 4) {
+			sprintf(msg, "Wrong number of arguments for command 'qs'");
+			error(msg);
+		}
+		else {
+			srand(atoi(args[1]));
+			int num = atoi(args[2]);
+			coord_t side = parse_coord(args[3]);
+			vector<BoundingBox> ranges;
+			for (int i = 0; i < num; i++)
+				ranges.push_back(random_range(dimension, side));
+			vector<int> result_count, node_travelled;
+			PageStats pages = page_stats(tree);
+			int shared_travelled = tree.query_range_shared(ranges, result_count, node_travelled);
+			int results = 0, travelled = 0;
+			for (int i = 0; i < num; i++) {
+				results += result_count[i];
+				travelled += node_travelled[i];
+			}
+			cout << "Number of results: " << results << endl;
+			cout << "Number of nodes visited: " << travelled << endl;
+			cout << "Number of nodes visited by the shared traversal: " << shared_travelled << endl;
+			print_page_reads(tree, pages);
+		}
+		return true;
+	}
+	else if (strcmp(args[0], "qd") == 0) { // radius query.
+		DistanceMetric metric = METRIC_L2;
+		bool valid = num_arg == dimension + 2 || num_arg == dimension + 3;
+		if (valid && num_arg == dimension + 3) {
+			if (strcmp(args[dimension + 2], "l1") == 0)
+				metric = METRIC_L1;
+			else if (strcmp(args[dimension + 2], "linf") == 0)
+				metric = METRIC_LINF;
+			else
+				valid = strcmp(args[dimension + 2], "l2") == 0;
+		}
+		if (!valid) {
+			sprintf(msg, "Wrong arguments for command 'qd'");
+			error(msg);
+		}
+		else {
+			vector<coord_t> center;
+			for (int i = 0; i < dimension; i++)
+			{
+				center.push_back(parse_coord(args[i + 1]));
+			}
+			int result_count = 0;
+			int node_travelled = 0;
+			PageStats pages = page_stats(tree);
+			tree.query_radius(center, atof(args[dimension + 1]), metric, result_count, node_travelled);
+			cout << "Number of results: " << result_count << endl;
+			cout << "Number of nodes visited: " << node_travelled << endl;
+			print_page_reads(tree, pages);
+		}
+		return true;
+	}
+	else if (strcmp(args[0], "sk") == 0) { // skyline query.
+		vector<Entry> result;
+		int node_travelled = 0;
+		PageStats pages = page_stats(tree);
+		tree.skyline(result, node_travelled);
+		for (int i = 0; i < result.size(); i++) {
+			print_record(result[i]);
+		}
+		cout << "Number of results: " << result.size() << endl;
+		cout << "Number of nodes visited: " << node_travelled << endl;
+		print_page_reads(tree, pages);
+		return true;
+	}
+	else if (strcmp(args[0], "fb") == 0 || strcmp(args[0], "fv") == 0) { // freeze.
+		if (num_arg != 1 && num_arg != 2) {
+			sprintf(msg, "Wrong number of arguments for command '%s'", args[0]);
+			error(msg);
+		}
+		else {
+			try {
+				tree.freeze(strcmp(args[0], "fv") == 0 ? VAN_EMDE_BOAS : BREADTH_FIRST, num_arg == 2 ? atoi(args[1]) : 0);
+			}
+			catch (bad_alloc& ba)  {
+				sprintf(msg, "bad_alloc caught <%s> ", ba.what());
+				error(msg);
+			}
+		}
+		return true;
+	}
+	else if (strcmp(args[0], "t") == 0) { // thaw.
+		tree.thaw();
+		return true;
+	}
+	else if (strcmp(args[0], "rp") == 0) { // publish to the replicas.
+		if (replicas().publish(tree))
+			replicas().stat();
+		return true;
+	}
+	else if (strcmp(args[0], "bu") == 0) { // buffer-tree mode.
+		if (num_arg != 2) {
+			sprintf(msg, "Wrong number of arguments for command 'bu'");
+			error(msg);
+		}
+		else {
+			tree.set_insert_buffer(atoi(args[1]));
+		}
+		return true;
+	}
+	else if (strcmp(args[0], "pb") == 0) { // I/O simulation.
+		if (num_arg != 1 && num_arg != 2) {
+			sprintf(msg, "Wrong number of arguments for command 'pb'");
+			error(msg);
+		}
+		else if (num_arg == 2) {
+			tree.set_page_buffer(atoi(args[1]));
+		}
+		else if (tree.get_page_buffer() == NULL) {
+			cout << "No page buffer is simulated.\n";
+		}
+		else {
+			const PageBuffer* buffer = tree.get_page_buffer();
+			const PageStats& pages = buffer->get_stats();
+			cout << "Page buffer: " << buffer->get_capacity() << " pages" << endl;
+			cout << "Number of page accesses: " << pages.accesses << endl;
+			cout << "Number of page reads: " << pages.reads << endl;
+			if (pages.accesses > 0)
+				cout << "Buffer hit ratio: " << (double)(pages.accesses - pages.reads) / pages.accesses << endl;
 		}
 		return true;
 	}
 	else if (strcmp(args[0], "s") == 0) { // statistics.
+		tree.thaw(); // the statistics walk the pointer tree
+		tree.flush_buffers(); // and count buffered records in their leaves
 		tree.stat();
 		return true;
 	}
 	else if (strcmp(args[0], "p") == 0) { // print tree.
+		tree.thaw();
+		tree.flush_buffers();
 		tree.print_tree();
 		return true;
 	}
@@ -241,32 +673,195 @@ bool process(char* cmd, RTree& tree, int dimension)
 	}
 }
 
+// The point key given by the ``dimension'' arguments from args[0].
+vector<coord_t> parse_point(char* args[], int dimension)
+{
+	vector<coord_t> coordinate;
+	for (int i = 0; i < dimension; i++)
+		coordinate.push_back(parse_coord(args[i]));
+	return coordinate;
+}
 
+// The range given by the ``dimension'' pairs of low and high arguments from args[0].
+BoundingBox parse_range(char* args[], int dimension)
+{
+	vector<coord_t> lowest;
+	vector<coord_t> highest;
+	for (int i = 0; i < dimension; i++) {
+		lowest.push_back(parse_coord(args[i*2]));
+		highest.push_back(parse_coord(args[1 + i*2]));
+	}
+	return BoundingBox(lowest, highest);
+}
 
-int main(int argc, char *argv[])
-{//argc also counts the argv[0] that is the name of the program
-	
-	if (argc < 3) {
-		cerr << "Usage: " << argv[0] << " Max_#entries_in_a_node Dimensionality_of_Rtree\" [file_containing_commmands].\n";
-		return 0;
+// Insert the records one at a time.
+template <class Index>
+int insert_records(Index& index, const vector<vector<coord_t> >& coordinates, const vector<int>& rids)
+{
+	int succeed = 0;
+	for (int i = 0; i < coordinates.size(); i++) {
+		if (index.insert(coordinates[i], rids[i]))
+			succeed++;
 	}
+	return succeed;
+}
 
-	// Create an R-tree.
-	int max_entry_num = atoi(argv[1]);
-	if (max_entry_num < 2) {
-		cerr << "Number of entries should be an integer > 2.\n";
-		return 0;
+// A sharded index takes the records as one batch, each shard inserting its share at once.
+int insert_records(ShardedRTree& index, const vector<vector<coord_t> >& coordinates, const vector<int>& rids)
+{
+	vector<BoundingBox> mbrs;
+	for (int i = 0; i < coordinates.size(); i++)
+		mbrs.push_back(BoundingBox(coordinates[i], coordinates[i]));
+	return index.insert_batch(mbrs, rids);
+}
+
+// Print the statistics of the index.
+template <class Index>
+void print_stat(Index& index)
+{
+	index.stat();
+}
+
+// A log-structured index is printed once its merges are done, so its runs do not depend on timing.
+void print_stat(LSMRTree& index)
+{
+	index.wait_merges();
+	index.stat();
+}
+
+//
+// Commands on an index made of several R-trees (see -shards and -lsm): the updates, the range and point
+// queries and the statistics, as for a single tree. The other commands need a single tree.
+//
+template <class Index>
+bool process(char* cmd, Index& index, int dimension)
+{
+	char* args[MAX_ARG_NUM];
+
+	char msg[1024]; // error message.
+	int num_arg = split_command(cmd, args, dimension);
+	if (num_arg == 0)
+		return true;
+	try {
+		if (strcmp(args[0], "i") == 0 || strcmp(args[0], "ib") == 0) { // insertion.
+			bool box = strcmp(args[0], "ib") == 0;
+			if (num_arg != (box ? 2 + dimension * 2 : 2 + dimension)) {
+				sprintf(msg, "Wrong number of arguments for command '%s'", args[0]);
+				error(msg);
+			}
+			else {
+				int rid = atoi(args[num_arg - 1]);
+				bool inserted = box ? index.insert(parse_range(args + 1, dimension), rid)
+					: index.insert(parse_point(args + 1, dimension), rid);
+				cout << (inserted ? "Insertion done.\n" : "Insertion failed.\n");
+			}
+		}
+		else if (strcmp(args[0], "d") == 0 || strcmp(args[0], "db") == 0) { // deletion.
+			bool box = strcmp(args[0], "db") == 0;
+			if (num_arg != (box ? 1 + dimension * 2 : 1 + dimension)) {
+				sprintf(msg, "Wrong number of arguments for command '%s'", args[0]);
+				error(msg);
+			}
+			else {
+				bool deleted = box ? index.del(parse_range(args + 1, dimension))
+					: index.del(parse_point(args + 1, dimension));
+				cout << (deleted ? "Deletion done.\n" : "Deletion failed.\n");
+			}
+		}
+		else if (strcmp(args[0], "ri") == 0) { // random insertion.
+			if (num_arg != 3) {
+				sprintf(msg, "Wrong number of arguments for command 'ri'");
+				error(msg);
+			}
+			else {
+				srand(atoi(args[1]));
+				int num = atoi(args[2]);
+				vector<vector<coord_t> > coordinates;
+				vector<int> rids;
+				for (int i = 0; i < num; i++) {
+					coordinates.push_back(random_point(dimension));
+					rids.push_back(rand());
+				}
+				int succeed = insert_records(index, coordinates, rids);
+				cout << succeed << " out of " << num << " insertion(s) suceeded.\n";
+			}
+		}
+		else if (strcmp(args[0], "rd") == 0) { // random deletion.
+			if (num_arg != 3) {
+				sprintf(msg, "Wrong number of arguments for command 'rd'");
+				error(msg);
+			}
+			else {
+				srand(atoi(args[1]));
+				int num = atoi(args[2]);
+				int succeed = 0;
+				for (int i = 0; i < num; i++) {
+					vector<coord_t> coordinate = random_point(dimension);
+					(void)rand(); // to be compatible with ``ri''.
+					if (index.del(coordinate))
+						succeed++;
+				}
+				cout << succeed << " out of " << num << " deletion(s) suceeded.\n";
+			}
+		}
+		else if (strcmp(args[0], "qr") == 0 || strcmp(args[0], "qc") == 0) { // range query.
+			if (num_arg != 1 + dimension * 2) {
+				sprintf(msg, "Wrong number of arguments for command '%s'", args[0]);
+				error(msg);
+			}
+			else {
+				int result_count = 0;
+				int node_travelled = 0;
+				index.query_range(parse_range(args + 1, dimension), result_count, node_travelled,
+					strcmp(args[0], "qc") == 0 ? CONTAINED_IN : INTERSECTS);
+				cout << "Number of results: " << result_count << endl;
+				cout << "Number of nodes visited: " << node_travelled << endl;
+			}
+		}
+		else if (strcmp(args[0], "qp") == 0) { // point query.
+			if (num_arg != 1 + dimension) {
+				sprintf(msg, "Wrong number of arguments for command 'qp'");
+				error(msg);
+			}
+			else {
+				Entry result;
+				if (index.query_point(parse_point(args + 1, dimension), result))
+					print_record(result);
+				else
+					cout << "Record not found.\n";
+			}
+		}
+		else if (strcmp(args[0], "s") == 0) { // statistics.
+			print_stat(index);
+		}
+		else if (strcmp(args[0], "h") == 0) { // print help menu.
+			help();
+		}
+		else if (strcmp(args[0], "x") == 0) { // exit
+			return false;
+		}
+		else {
+			sprintf(msg, "Command '%s' needs a single tree; this index takes i, ib, d, db, ri, rd, qr, qc, qp, s, h and x.", args[0]);
+			error(msg);
+		}
 	}
-	int dimension = atoi(argv[2]);
-	RTree tree(max_entry_num, dimension);
+	catch (bad_alloc& ba)  {
+		sprintf(msg, "bad_alloc caught <%s> ", ba.what());
+		error(msg);
+	}
+	return true;
+}
 
-	// Processing input commands.
+// Run the commands of ``file'', or of the standard input if it is NULL, on ``index''.
+template <class Index>
+void run_commands(Index& index, int dimension, const char* file)
+{
 	char command[MAX_CMD_LEN];
-	if (argc == 4) {
-		ifstream fin(argv[3]);
+	if (file != NULL) {
+		ifstream fin(file);
 		while (fin.getline(command, MAX_CMD_LEN)) {
 			//cout << command << endl;
-			if (! process(command, tree, dimension))
+			if (! process(command, index, dimension))
 				break;
 		}
 	}
@@ -274,10 +869,103 @@ int main(int argc, char *argv[])
 		while (true) {
 			cout << ">> ";
 			cin.getline(command, MAX_CMD_LEN);
-			if (! process(command, tree, dimension))
+			if (! process(command, index, dimension))
 				break;
 		}
 	}
+}
+
+
+
+// Node capacities for ``dimension'' picked by timing random insertions and range queries.
+NodeCapacity calibrate(int dimension)
+{
+	srand(0);
+	vector<vector<coord_t> > sample;
+	for (int i = 0; i < CALIBRATION_SAMPLE; i++)
+		sample.push_back(random_point(dimension));
+	vector<BoundingBox> queries;
+	for (int i = 0; i < CALIBRATION_QUERIES; i++)
+		queries.push_back(random_range(dimension, DOMAIN_SIZE / 20));
+	return RTree::calibrate(dimension, sample, queries);
+}
+
+int main(int argc, char *argv[])
+{//argc also counts the argv[0] that is the name of the program
+	
+	// -hilbert selects the Hilbert engine instead of Guttman's R-tree; -shards splits the index
+	// into R-trees of their own, -lsm into the runs of a log-structured merge tree
+	const char* program = argv[0];
+	TreeEngine engine = GUTTMAN_ENGINE;
+	int shard_num = 0;
+	int memtable_size = 0;
+	if (argc > 1 && strcmp(argv[1], "-hilbert") == 0) {
+		engine = HILBERT_ENGINE;
+		argc--;
+		argv++;
+	}
+	else if (argc > 2 && strcmp(argv[1], "-shards") == 0) {
+		shard_num = atoi(argv[2]);
+		argc -= 2;
+		argv += 2;
+		if (shard_num < 1) {
+			cerr << "Number of shards should be an integer > 0.\n";
+			return 0;
+		}
+	}
+	else if (argc > 2 && strcmp(argv[1], "-lsm") == 0) {
+		memtable_size = atoi(argv[2]);
+		argc -= 2;
+		argv += 2;
+		if (memtable_size < 1) {
+			cerr << "Size of the memtable should be an integer > 0.\n";
+			return 0;
+		}
+	}
+	if (argc < 3) {
+		cerr << "Usage: " << program << " [-hilbert | -shards n | -lsm memtable_size] Max_#entries_in_a_node Dimensionality_of_Rtree\" [file_containing_commmands].\n";
+		cerr << "     Max_#entries_in_a_node is one capacity for all nodes, leaf:internal capacities,\n";
+		cerr << "     or 'auto' to calibrate both on a random sample.\n";
+		cerr << "     -hilbert builds a Hilbert R-tree, whose nodes are fuller.\n";
+		cerr << "     -shards splits the index by Hilbert value into n R-trees updated and queried in parallel;\n";
+		cerr << "     -lsm keeps a log-structured merge tree, its memtable flushed into a run every memtable_size records;\n";
+		cerr << "     both take the commands i, ib, d, db, ri, rd, qr, qc, qp, s, h and x.\n";
+		return 0;
+	}
+
+	// Create an R-tree.
+	int dimension = atoi(argv[2]);
+	NodeCapacity capacity;
+	if (strcmp(argv[1], "auto") == 0) {
+		capacity = calibrate(dimension);
+		cout << "Calibrated node capacities: " << capacity.leaf << " per leaf, " << capacity.internal << " per internal node.\n";
+	}
+	else {
+		capacity.leaf = atoi(argv[1]);
+		const char* internal = strchr(argv[1], ':');
+		capacity.internal = internal != NULL ? atoi(internal + 1) : capacity.leaf;
+	}
+	if (capacity.leaf < 2 || capacity.internal < 2) {
+		cerr << "Number of entries should be an integer > 2.\n";
+		return 0;
+	}
+
+	// Processing input commands.
+	const char* file = argc == 4 ? argv[3] : NULL;
+	if (shard_num > 0) {
+		// the Hilbert values of the shards cover the domain of the random commands
+		ShardedRTree index(capacity.leaf, capacity.internal, dimension, shard_num,
+			BoundingBox(vector<coord_t>(dimension, 0), vector<coord_t>(dimension, DOMAIN_SIZE - 1)));
+		run_commands(index, dimension, file);
+	}
+	else if (memtable_size > 0) {
+		LSMRTree index(capacity.leaf, capacity.internal, dimension, memtable_size);
+		run_commands(index, dimension, file);
+	}
+	else {
+		RTree tree(capacity.leaf, capacity.internal, dimension, engine);
+		run_commands(tree, dimension, file);
+	}
 
 	return 0;
 }
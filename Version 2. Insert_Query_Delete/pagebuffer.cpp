@@ -0,0 +1,51 @@
+/* Implementations of the simulated page buffer */
+#include "pagebuffer.h"
+
+
+PageBuffer::PageBuffer(int capacity)
+{
+	this->capacity = capacity > 0 ? capacity : 1;
+	stats.accesses = 0;
+	stats.reads = 0;
+}
+
+
+//
+// Access ``page''. Return: whether it was in the buffer.
+//
+bool PageBuffer::access(int page)
+{
+	stats.accesses++;
+	unordered_map<int, list<int>::iterator>::iterator it = where.find(page);
+	if (it != where.end()) {
+		pages.splice(pages.begin(), pages, it->second);
+		return true;
+	}
+	stats.reads++;
+	if (pages.size() >= capacity) {
+		where.erase(pages.back());
+		pages.pop_back();
+	}
+	pages.push_front(page);
+	where[page] = pages.begin();
+	return false;
+}
+
+//
+// Empty the buffer, as when the pages are laid out anew; the counts are kept.
+//
+void PageBuffer::clear()
+{
+	pages.clear();
+	where.clear();
+}
+
+int PageBuffer::get_capacity() const
+{
+	return capacity;
+}
+
+const PageStats& PageBuffer::get_stats() const
+{
+	return stats;
+}
@@ -0,0 +1,33 @@
+/* Definitions of the simulated page buffer */
+
+#include <list>
+#include <unordered_map>
+
+using namespace std;
+
+// Page accesses counted by a PageBuffer; those that missed the buffer are reads.
+struct PageStats {
+	long long accesses;
+	long long reads;
+};
+
+//
+// Simulated buffer pool of ``capacity'' pages with least-recently-used replacement. It holds only
+// page ids: an access of a page not in the buffer counts as a read from disk and brings the page
+// in, evicting the least recently used one if the buffer is full.
+//
+class PageBuffer {
+	public:
+		PageBuffer(int capacity);
+
+		bool access(int page);
+		void clear();
+		int get_capacity() const;
+		const PageStats& get_stats() const;
+
+	private:
+		int capacity;
+		list<int> pages;	// most recently used first
+		unordered_map<int, list<int>::iterator> where;	// the position of each page in ``pages''
+		PageStats stats;
+};
@@ -0,0 +1,267 @@
+/* Implementations of the NUMA-replicated R-tree */
+#include "replicatedrtree.h"
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+
+const int MAX_NUMA_NODES = 1024; // node directories looked for under /sys
+
+
+//
+// Parse a CPU list of the kernel, e.g. ``0-3,8-11''.
+//
+static vector<int> parse_cpu_list(const char* list)
+{
+	vector<int> cpus;
+	const char* p = list;
+	while (*p != '\0' && *p != '\n') {
+		char* end;
+		int first = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		int last = first;
+		p = end;
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+		if (*p == ',')
+			p++;
+	}
+	return cpus;
+}
+
+//
+// Find the NUMA nodes and their CPUs in /sys; without them the machine is one node of all CPUs.
+//
+ReplicatedRTree::ReplicatedRTree()
+{
+	version = 0;
+	for (int n = 0; n < MAX_NUMA_NODES; n++) {
+		char path[64], list[4096];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+		FILE* file = fopen(path, "r");
+		if (file == NULL)
+			continue;
+		vector<int> cpus;
+		if (fgets(list, sizeof(list), file) != NULL)
+			cpus = parse_cpu_list(list);
+		fclose(file);
+		if (cpus.empty())
+			continue;	// a node of memory only
+		ReplicaNode* node = new ReplicaNode();
+		node->cpus = cpus;
+		nodes.push_back(node);
+	}
+	if (nodes.empty()) {
+		ReplicaNode* node = new ReplicaNode();
+		long cpu_num = sysconf(_SC_NPROCESSORS_CONF);
+		for (int cpu = 0; cpu < max(cpu_num, 1L); cpu++)
+			node->cpus.push_back(cpu);
+		nodes.push_back(node);
+	}
+	for (int n = 0; n < nodes.size(); n++) {
+		pthread_mutex_init(&nodes[n]->lock, NULL);
+		nodes[n]->current = NULL;
+		for (int i = 0; i < nodes[n]->cpus.size(); i++) {
+			int cpu = nodes[n]->cpus[i];
+			if (cpu >= cpu_nodes.size())
+				cpu_nodes.resize(cpu + 1, -1);
+			cpu_nodes[cpu] = n;
+		}
+	}
+}
+
+ReplicatedRTree::~ReplicatedRTree()
+{
+	for (int n = 0; n < nodes.size(); n++) {
+		if (nodes[n]->current != NULL)
+			release(n, nodes[n]->current);
+		pthread_mutex_destroy(&nodes[n]->lock);
+		delete nodes[n];
+	}
+}
+
+
+//
+// Take the current replica of ``node'' for a query, NULL if nothing is published. It stays valid,
+// even if a new version is published meanwhile, until release().
+//
+Replica* ReplicatedRTree::acquire(int node)
+{
+	if (node < 0 || node >= nodes.size()) {
+		cerr << "There is no NUMA node " << node << endl;
+		return NULL;
+	}
+	pthread_mutex_lock(&nodes[node]->lock);
+	Replica* replica = nodes[node]->current;
+	if (replica != NULL)
+		replica->readers++;
+	pthread_mutex_unlock(&nodes[node]->lock);
+	if (replica == NULL)
+		cerr << "No version of the R-tree has been published\n";
+	return replica;
+}
+
+//
+// Let go of a replica of ``node''; the last one to do so after it is replaced frees it.
+//
+void ReplicatedRTree::release(int node, Replica* replica)
+{
+	pthread_mutex_lock(&nodes[node]->lock);
+	bool last = --replica->readers == 0;
+	pthread_mutex_unlock(&nodes[node]->lock);
+	if (last) {
+		delete replica->tree;
+		delete replica;
+	}
+}
+
+// The copy of a published tree made on one node, see publish().
+struct CopyTask {
+	ReplicatedRTree* store;
+	int node;
+	const RTree* tree;
+	RTree* copy;
+};
+
+//
+// A thread of publish(). Bound to its node, it makes the copy there: the kernel places the pages
+// of the array on the node of the thread that first writes them.
+//
+void* ReplicatedRTree::run_copier(void* arg)
+{
+	CopyTask* task = (CopyTask*)arg;
+	task->store->bind_thread(task->node);
+	task->copy = task->tree->replicate();
+	return NULL;
+}
+
+
+int ReplicatedRTree::node_num() const
+{
+	return nodes.size();
+}
+
+//
+// Pin the calling thread to the CPUs of ``node'', so its memory is allocated there and its
+// queries read the local replica. False if it could not be done.
+//
+bool ReplicatedRTree::bind_thread(int node)
+{
+	if (node < 0 || node >= nodes.size())
+		return false;
+#ifdef __linux__
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (int i = 0; i < nodes[node]->cpus.size(); i++)
+		if (nodes[node]->cpus[i] < CPU_SETSIZE)
+			CPU_SET(nodes[node]->cpus[i], &cpus);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+	return false;
+#endif
+}
+
+//
+// The node of the CPU running the calling thread, 0 if unknown.
+//
+int ReplicatedRTree::current_node() const
+{
+#ifdef __linux__
+	int cpu = sched_getcpu();
+	if (cpu >= 0 && cpu < cpu_nodes.size() && cpu_nodes[cpu] >= 0)
+		return cpu_nodes[cpu];
+#endif
+	return 0;
+}
+
+//
+// Make a frozen tree the current version: it is copied to every node at once, then the queries
+// started from then on read the copies. The tree itself is left to the caller, who may thaw it
+// and go on writing. False, and nothing changes, unless the tree is frozen.
+//
+bool ReplicatedRTree::publish(const RTree& tree)
+{
+	if (!tree.is_frozen()) {
+		cerr << "Only a frozen R-tree can be published\n";
+		return false;
+	}
+	vector<CopyTask> tasks(nodes.size());
+	vector<pthread_t> threads(nodes.size());
+	vector<bool> started(nodes.size());
+	for (int n = 0; n < nodes.size(); n++) {
+		tasks[n].store = this;
+		tasks[n].node = n;
+		tasks[n].tree = &tree;
+		tasks[n].copy = NULL;
+		started[n] = pthread_create(&threads[n], NULL, run_copier, &tasks[n]) == 0;
+	}
+	for (int n = 0; n < nodes.size(); n++) {
+		if (started[n])
+			pthread_join(threads[n], NULL);
+		else
+			tasks[n].copy = tree.replicate();	// placed wherever the caller runs
+	}
+
+	version++;
+	for (int n = 0; n < nodes.size(); n++) {
+		Replica* replica = new Replica();
+		replica->tree = tasks[n].copy;
+		replica->version = version;
+		replica->readers = 1;
+		pthread_mutex_lock(&nodes[n]->lock);
+		Replica* old = nodes[n]->current;
+		nodes[n]->current = replica;
+		pthread_mutex_unlock(&nodes[n]->lock);
+		if (old != NULL)
+			release(n, old);
+	}
+	return true;
+}
+
+//
+// Range query of the current version, read from the replica of ``node''. Any number of threads
+// may query at once, each with its own ``scratch'' and best bound to ``node'', see bind_thread().
+//
+void ReplicatedRTree::query_range(int node, const BoundingBox& mbr, int& result_count, int& node_travelled, RangePredicate pred, QueryScratch& scratch)
+{
+	result_count = 0;
+	node_travelled = 0;
+	Replica* replica = acquire(node);
+	if (replica == NULL)
+		return;
+	replica->tree->query_range(mbr, result_count, node_travelled, pred, scratch);
+	release(node, replica);
+}
+
+//
+// Point query of the current version, read from the replica of ``node'', see query_range().
+//
+bool ReplicatedRTree::query_point(int node, const vector<coord_t>& coordinate, Entry& result, QueryScratch& scratch)
+{
+	Replica* replica = acquire(node);
+	if (replica == NULL)
+		return false;
+	bool found = replica->tree->query_point(coordinate, result, scratch);
+	release(node, replica);
+	return found;
+}
+
+void ReplicatedRTree::stat()
+{
+	cout << "Number of NUMA nodes: " << nodes.size() << endl;
+	for (int n = 0; n < nodes.size(); n++) {
+		pthread_mutex_lock(&nodes[n]->lock);
+		int replica_version = nodes[n]->current == NULL ? 0 : nodes[n]->current->version;
+		pthread_mutex_unlock(&nodes[n]->lock);
+		cout << "  Node " << n << ": " << nodes[n]->cpus.size() << " CPUs, version " << replica_version << endl;
+	}
+	cout << "Published version: " << version << endl;
+}
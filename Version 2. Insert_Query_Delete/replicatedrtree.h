@@ -0,0 +1,49 @@
+/* Definitions of the NUMA-replicated R-tree */
+
+#include "rtree.h"
+#include <pthread.h>
+
+// A published version of a ReplicatedRTree on one NUMA node, freed when the last reader lets go.
+struct Replica {
+	RTree* tree;		// frozen, its array placed on the node
+	int version;
+	int readers;		// queries running on the replica, and 1 while it is the current one
+};
+
+// A NUMA node of the machine and its replica of the current version.
+struct ReplicaNode {
+	vector<int> cpus;
+	pthread_mutex_t lock;	// guards ``current'' and the ``readers'' of the replicas of the node
+	Replica* current;		// NULL until the first version is published
+};
+
+//
+// Read-mostly index that keeps a copy of a frozen RTree in the memory of every NUMA node, so the
+// queries of a thread bound to a node, see bind_thread(), read only local memory. The writer
+// keeps its own RTree and publishes a frozen version of it; a thread pinned to each node copies it
+// there, and queries move to the new version while those in flight finish on the old one.
+//
+class ReplicatedRTree {
+	public:
+		ReplicatedRTree();
+		~ReplicatedRTree();
+
+	private:
+		Replica* acquire(int node);
+		void release(int node, Replica* replica);
+		static void* run_copier(void* arg);
+
+	public:
+		int node_num() const;
+		bool bind_thread(int node);
+		int current_node() const;
+		bool publish(const RTree& tree);
+		void query_range(int node, const BoundingBox& mbr, int& result_count, int& node_travelled, RangePredicate pred, QueryScratch& scratch);
+		bool query_point(int node, const vector<coord_t>& coordinate, Entry& result, QueryScratch& scratch);
+		void stat();
+
+	private:
+		vector<ReplicaNode*> nodes;
+		vector<int> cpu_nodes;		// the node of each CPU, -1 for those of no node
+		int version;				// of the last published version
+};
@@ -4,13 +4,12 @@
 //======================== Entry implementation =====================================================
 
 Entry::Entry():mbr() {
-	this->rid = -1;
 	this->ptr = NULL;
 }
 
 Entry::Entry(const BoundingBox& thatMBR, const int rid):mbr(thatMBR) {
-	this->rid = rid;
 	this->ptr = NULL;
+	this->rid = rid;
 }
 
 Entry::~Entry() {
@@ -35,10 +34,24 @@ void Entry::set_mbr(const BoundingBox& thatMBR) {
 	this->mbr.set_boundingbox(thatMBR);
 }
 
+void Entry::group_mbr(const BoundingBox& thatMBR) {
+	this->mbr.group_with(thatMBR);
+}
+
 void Entry::set_ptr(RTNode* ptr) {
 	this->ptr = ptr;
 }
 
+void Entry::set_record(const coord_t* low, const coord_t* high, int dim, int rid) {
+	this->mbr.set_box(low, high, dim);
+	this->rid = rid;
+}
+
+void Entry::swap(Entry& other) {
+	this->mbr.swap(other.mbr);
+	std::swap(this->ptr, other.ptr);
+}
+
 void Entry::print() {
 	this->mbr.print();
 	cout << this->rid << endl;
@@ -47,17 +60,44 @@ void Entry::print() {
 
 //======================== RTNode implementation ==============================================
 
-RTNode::RTNode(int lev, int s)
+RTNode::RTNode(int lev, int s, int d, bool b)
 {
 	entry_num = 0;
-	entries = new Entry[s];
 	level = lev;
 	size = s;
+	dim = d;
+	boxes = b;
+	buffered_below = false;
+	hilbert_max = 0;
+	page = 0;
+	entries = NULL;
+	coords = NULL;
+	rids = NULL;
+	if (level == 0) {
+		coords = new coord_t[s * (boxes ? 2 * d : d)];
+		rids = new int[s];
+	}
+	else
+		entries = new Entry[s];
 }
 
 RTNode::RTNode(const RTNode& other)
 {
-	entries = new Entry[other.size];
+	// storage of the same shape; operator= then copies everything else, the buffer included
+	level = other.level;
+	size = other.size;
+	dim = other.dim;
+	boxes = other.boxes;
+	page = 0;
+	entries = NULL;
+	coords = NULL;
+	rids = NULL;
+	if (level == 0) {
+		coords = new coord_t[size * (boxes ? 2 * dim : dim)];
+		rids = new int[size];
+	}
+	else
+		entries = new Entry[size];
 	*this = other;
 }
 
@@ -67,8 +107,18 @@ RTNode& RTNode::operator=(const RTNode& other)
 		entry_num = other.entry_num;
 		level = other.level;
 		size = other.size;
-		for (int i = 0; i < entry_num; i++)
-			entries[i] = other.entries[i];
+		dim = other.dim;
+		if (level == 0 && other.boxes && !boxes)
+			widen();
+		for (int i = 0; i < entry_num; i++) {
+			if (level == 0)
+				set_record(i, other.get_point(i), other.get_high(i), other.get_rid(i));
+			else
+				entries[i] = other.entries[i];
+		}
+		buffer = other.buffer;
+		buffered_below = other.buffered_below;
+		hilbert_max = other.hilbert_max;
 	}
 	return *this;
 }
@@ -83,7 +133,81 @@ RTNode::~RTNode()
 		}
 	}
 	delete []entries;
+	delete []coords;
+	delete []rids;
 	entries = NULL;
+	coords = NULL;
+	rids = NULL;
+}
+
+const coord_t* RTNode::get_point(int i) const
+{
+	return boxes ? coords + 2 * i * dim : coords + i * dim;
+}
+
+const coord_t* RTNode::get_high(int i) const
+{
+	return boxes ? coords + (2 * i + 1) * dim : coords + i * dim;
+}
+
+int RTNode::get_rid(int i) const
+{
+	return rids[i];
+}
+
+//
+// Copy the i-th record of this leaf into ``record'', as its MBR and record id.
+//
+void RTNode::get_record(int i, Entry& record) const
+{
+	record.set_record(get_point(i), get_high(i), dim, rids[i]);
+}
+
+//
+// Store a record at slot i of this leaf. A point leaf only keeps the lowest corner.
+//
+void RTNode::set_record(int i, const coord_t* low, const coord_t* high, int rid)
+{
+	coord_t* dest = coords + (boxes ? 2 * i * dim : i * dim);
+	for (int j = 0; j < dim; j++)
+		dest[j] = low[j];
+	if (boxes) {
+		for (int j = 0; j < dim; j++)
+			dest[dim + j] = high[j];
+	}
+	rids[i] = rid;
+}
+
+//
+// Store the record carried by ``record'' at slot i of this leaf.
+//
+void RTNode::set_record(int i, const Entry& record)
+{
+	const BoundingBox& mbr = record.get_mbr();
+	set_record(i, &mbr.get_lowest()[0], &mbr.get_highest()[0], record.get_rid());
+}
+
+void RTNode::swap_record(int i, int j)
+{
+	int width = boxes ? 2 * dim : dim;
+	for (int k = 0; k < width; k++)
+		std::swap(coords[i * width + k], coords[j * width + k]);
+	std::swap(rids[i], rids[j]);
+}
+
+//
+// Turn a point leaf into a rectangle leaf, each point becoming a degenerate rectangle.
+//
+void RTNode::widen()
+{
+	if (level != 0 || boxes)
+		return;
+	coord_t* points = coords;
+	coords = new coord_t[size * 2 * dim];
+	boxes = true;
+	for (int i = 0; i < entry_num; i++)
+		set_record(i, points + i * dim, points + i * dim, rids[i]);
+	delete []points;
 }
 
 
@@ -7,8 +7,10 @@ class RTNode;
 class Entry {
 private:
 	BoundingBox mbr;
-	RTNode* ptr;		//point to the node this entry represents, valid only if this is a non-leaf node entry.
-	int rid;			// valid only if this is a leaf node entry.
+	union {
+		RTNode* ptr;	//point to the node this entry represents, valid only if this is a non-leaf node entry.
+		int rid;		// valid only if this entry carries a record.
+	};
 	
 public:
 	Entry();
@@ -19,21 +21,49 @@ public:
 	int get_rid() const;
 
 	void set_mbr(const BoundingBox& thatMBR);
+	void group_mbr(const BoundingBox& thatMBR);
 	void set_ptr(RTNode* ptr);
+	void set_record(const coord_t* low, const coord_t* high, int dim, int rid);
+	void swap(Entry& other);
 
 	void print();
 };
 
+//
+// A non-leaf node keeps an Entry (MBR and child pointer) per child.
+// A leaf node keeps its records packed in ``coords'' and the record ids in ``rids''.
+// A record is a point of ``dim'' coordinates, or a rectangle of 2 * ``dim'' (lowest, then highest
+// corner) if the leaf holds ``boxes''.
+// In buffer-tree mode a non-leaf node also keeps the records routed to it but not yet pushed
+// further down in ``buffer'' (see RTree::set_insert_buffer()).
+//
 class RTNode {
 	public:
-		RTNode(int lev, int size);        
+		RTNode(int lev, int size, int dim, bool boxes);
 		RTNode(const RTNode& other);
 		RTNode& operator=(const RTNode& other);
 		~RTNode();
 
+		const coord_t* get_point(int i) const; // lowest corner of a rectangle record
+		const coord_t* get_high(int i) const;
+		int get_rid(int i) const;
+		void get_record(int i, Entry& record) const;
+		void set_record(int i, const coord_t* low, const coord_t* high, int rid);
+		void set_record(int i, const Entry& record);
+		void swap_record(int i, int j);
+		void widen();
+
 	public:
 		int entry_num;
-		Entry* entries;
+		Entry* entries;	// valid only if this is a non-leaf node.
+		coord_t* coords;	// valid only if this is a leaf node.
+		int* rids;		// valid only if this is a leaf node.
 		int level;
 		int size;
+		int dim;
+		bool boxes;		// whether leaf records are rectangles rather than points.
+		vector<Entry> buffer;	// records waiting to be pushed down, only in non-leaf nodes.
+		bool buffered_below;	// whether the buffer of a node below holds records.
+		unsigned long long hilbert_max;	// largest Hilbert value below the node, or more after deletions; kept by the Hilbert engine (see RTree::hilbert_insert()).
+		int page;		// id of the disk page of the node, see RTree::set_page_buffer(); not copied by operator=
 };
@@ -1,29 +1,197 @@
 /* Implementations of R tree */
 #include <cmath>
 #include "rtree.h"
+#include "hilbert.h"
 #include <algorithm>
+#include <limits>
+#include <map>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <queue>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 
 const double EPSILON = 1E-10;
+const size_t CACHE_LINE = 64;
+const size_t HUGE_PAGE = 2 << 20;
+const size_t BASE_PAGE = 4096;
+const int JOIN_TASKS_PER_THREAD = 8; // subtree pairs per thread a parallel join is split into
+const int QUERY_GROUP_SIZE = 16; // traversals interleaved by the batch queries on a frozen tree
+const double SUMMARY_STALE_FRACTION = 0.05; // share of the records changed before estimate_range() counts them again
+const int SUMMARY_NODES = 4096; // nodes the deepest level of the summary of estimate_range() may have at full fanout
+
+// Hint the cache to fetch ``addr'' ahead of its use; a no-op without the GCC builtin.
+static inline void prefetch(const void* addr)
+{
+#ifdef __GNUC__
+	__builtin_prefetch(addr);
+#endif
+}
+
+// Prefetch the entries of ``node'' and the packed records of a leaf, whichever it has: the other
+// pointer is NULL. No branch waits for ``node'' to arrive, so the load overlaps the work.
+static inline void prefetch_content(const RTNode* node)
+{
+	prefetch(node->coords);
+	prefetch(node->entries);
+}
+
+// Count the visit of a node stored in ``page'' if the I/O simulation is on, see RTree::set_page_buffer().
+static inline void read_page(PageBuffer* buffer, int page)
+{
+	if (buffer != NULL)
+		buffer->access(page);
+}
 
 RTree::RTree(int entry_num)
 {
 	max_entry_num = entry_num;
+	max_leaf_num = entry_num;
 	dimension = 2;//by default
-	root = new RTNode(0, entry_num);
+	box_records = false;
+	engine = GUTTMAN_ENGINE;
+	hilbert_bits = 0;
+	root = new RTNode(0, entry_num, dimension, false);
+	frozen = NULL;
+	frozen_bits = 0;
+	frozen_fanout = 0;
+	frozen_bytes = 0;
+	buffer_capacity = 0;
+	buffered_num = 0;
+	page_buffer = NULL;
+	next_page = 1;
+	summary.built = false;
+	summary.changes = 0;
+	init_split_scratch();
 }
 
 RTree::RTree(int entry_num, int dim)
 {
 	max_entry_num = entry_num;
+	max_leaf_num = entry_num;
 	dimension = dim;//by default
-	root = new RTNode(0, entry_num);
+	box_records = false;
+	engine = GUTTMAN_ENGINE;
+	hilbert_bits = 0;
+	root = new RTNode(0, entry_num, dimension, false);
+	frozen = NULL;
+	frozen_bits = 0;
+	frozen_fanout = 0;
+	frozen_bytes = 0;
+	buffer_capacity = 0;
+	buffered_num = 0;
+	page_buffer = NULL;
+	next_page = 1;
+	summary.built = false;
+	summary.changes = 0;
+	init_split_scratch();
+}
+
+RTree::RTree(int leaf_entry_num, int entry_num, int dim, TreeEngine engine)
+{
+	max_entry_num = entry_num;
+	max_leaf_num = leaf_entry_num;
+	dimension = dim;
+	box_records = false;
+	this->engine = engine;
+	hilbert_bits = 0;
+	root = new RTNode(0, leaf_entry_num, dimension, false);
+	frozen = NULL;
+	frozen_bits = 0;
+	frozen_fanout = 0;
+	frozen_bytes = 0;
+	buffer_capacity = 0;
+	buffered_num = 0;
+	page_buffer = NULL;
+	next_page = 1;
+	summary.built = false;
+	summary.changes = 0;
+	init_split_scratch();
 }
 
 RTree::~RTree()
 {
 	delete root;
 	root = NULL;
+	for (int i = 0; i < spare_leaves.size(); i++)
+		delete spare_leaves[i];
+	for (int i = 0; i < spare_nodes.size(); i++)
+		delete spare_nodes[i];
+	free(frozen);
+	frozen = NULL;
+	delete page_buffer;
+	delete []split_buffer;
+	delete []split_order;
+	delete []split_seeds;
+	delete []split_extent;
+}
+
+
+//
+// Allocate a node of this tree at ``level'', with the leaf or the internal node capacity.
+// A node freed by free_node() is reused if there is one, with its page.
+//
+RTNode* RTree::create_node(int level)
+{
+	vector<RTNode*>& spare = level == 0 ? spare_leaves : spare_nodes;
+	if (!spare.empty()) {
+		RTNode* node = spare.back();
+		spare.pop_back();
+		node->level = level;
+		if (level == 0 && box_records && !node->boxes)
+			node->widen();
+		return node;
+	}
+	RTNode* node = new RTNode(level, level == 0 ? max_leaf_num : max_entry_num, dimension, box_records);
+	node->page = next_page++;
+	return node;
+}
+
+//
+// Keep ``node'' and the nodes below it for create_node(), instead of freeing their memory.
+//
+void RTree::free_node(RTNode* node)
+{
+	if (node->level != 0) {
+		for (int i = 0; i < node->entry_num; i++)
+			free_node(node->entries[i].get_ptr());
+	}
+	node->entry_num = 0;
+	node->buffer.clear();
+	node->buffered_below = false;
+	node->hilbert_max = 0;
+	(node->level == 0 ? spare_leaves : spare_nodes).push_back(node);
+}
+
+
+//
+// Switch every leaf below ``node'' to rectangle records.
+//
+void RTree::widen_leaves(RTNode* node)
+{
+	if (node->level == 0) {
+		node->widen();
+		return;
+	}
+	for (int i = 0; i < node->entry_num; i++)
+		widen_leaves(node->entries[i].get_ptr());
+}
+
+
+//
+// Allocate the scratch space shared by all node splits of this tree.
+//
+void RTree::init_split_scratch()
+{
+	int len = max(max_leaf_num, max_entry_num) + 1;
+	split_buffer = new Entry[len];
+	split_order = new int[len];
+	split_seeds = new int[2 * dimension];
+	split_extent = new coord_t[2 * dimension];
 }
 
 
@@ -44,7 +212,7 @@ bool RTree::same_entry(const Entry& e1, const Entry& e2)
 // Check whether two boundingboxs overlap.
 // Return true if so, otherwise false.
 //
-bool RTree::overlap(const BoundingBox box1, const BoundingBox box2)
+bool RTree::overlap(const BoundingBox& box1, const BoundingBox& box2) const
 {
 	return box1.is_intersected(box2);
 }
@@ -72,10 +240,61 @@ BoundingBox RTree::get_mbr(Entry* entry_list, int len)
 }
 
 
+//
+// Calculate the MBR of the entries and the buffered records of ``node'', or of the points of a leaf.
+//
+BoundingBox RTree::get_mbr(const RTNode* node)
+{
+	if (node->level != 0) {
+		BoundingBox mbr = get_mbr(node->entries, node->entry_num);
+		for (int i = 0; i < node->buffer.size(); i++)
+			mbr.group_with(node->buffer[i].get_mbr());
+		return mbr;
+	}
+	vector<coord_t> lowest(node->get_point(0), node->get_point(0) + dimension);
+	vector<coord_t> highest(node->get_high(0), node->get_high(0) + dimension);
+	for (int i = 1; i < node->entry_num; i++) {
+		const coord_t* low = node->get_point(i);
+		const coord_t* high = node->get_high(i);
+		for (int j = 0; j < dimension; j++) {
+			lowest[j] = min(lowest[j], low[j]);
+			highest[j] = max(highest[j], high[j]);
+		}
+	}
+	return BoundingBox(lowest, highest);
+}
+
+
+//
+// Append ``e'' to ``node'', which must have room for it. A leaf stores the record carried by ``e''.
+//
+void RTree::append_entry(RTNode* node, const Entry& e)
+{
+	if (node->level == 0)
+		node->set_record(node->entry_num, e);
+	else
+		node->entries[node->entry_num] = e;
+	node->entry_num++;
+}
+
+
+//
+// Like append_entry(), but entries of non-leaf nodes are moved out of ``e'' instead of copied.
+//
+void RTree::take_entry(RTNode* node, Entry& e)
+{
+	if (node->level == 0)
+		node->set_record(node->entry_num, e);
+	else
+		node->entries[node->entry_num].swap(e);
+	node->entry_num++;
+}
+
+
 //
 // Return the area of a boundingbox ``mbr''.
 //
-int RTree::area(const BoundingBox& mbr)
+area_t RTree::area(const BoundingBox& mbr)
 {
 	return mbr.get_area();
 }
@@ -86,76 +305,104 @@ int RTree::area(const BoundingBox& mbr)
 //
 void RTree::swap_entry(Entry* entry_list, int id1, int id2)
 {
-	Entry temp = entry_list[id1];
-	entry_list[id1] = entry_list[id2];
-	entry_list[id2] = temp;
+	entry_list[id1].swap(entry_list[id2]);
+}
+
+
+//
+// Remove entry ``i'' of ``node'' by moving it past the last entry, which takes its place.
+// The Hilbert engine shifts the following entries down instead, to keep them in order.
+//
+void RTree::detach_entry(RTNode* node, int i)
+{
+	int last = node->entry_num - 1;
+	if (engine == HILBERT_ENGINE) {
+		for (int k = i; k < last; k++) {
+			if (node->level == 0)
+				node->swap_record(k, k + 1);
+			else
+				swap_entry(node->entries, k, k + 1);
+		}
+	}
+	else if (node->level == 0)
+		node->swap_record(i, last);
+	else
+		swap_entry(node->entries, i, last);
+	node->entry_num--;
 }
 
 
 //
 // Calculate the area enlarged by add the new entry to the existing MBR.
 //
-int RTree::area_inc(const BoundingBox& mbr, const BoundingBox& entry_mbr)
+area_t RTree::area_inc(const BoundingBox& mbr, const BoundingBox& entry_mbr)
 {
-	BoundingBox new_mbr(mbr);
-	new_mbr.group_with(entry_mbr);
-	return area(new_mbr) - area(mbr);
+	// area of the merged MBR, computed in place rather than on a merged copy
+	area_t new_area = 1;
+	for (int i = 0; i < mbr.get_dim(); i++) {
+		new_area *= (area_t)max(mbr.get_highestValue_at(i), entry_mbr.get_highestValue_at(i))
+			- (area_t)min(mbr.get_lowestValue_at(i), entry_mbr.get_lowestValue_at(i));
+	}
+	return new_area - area(mbr);
 }
 
 //
 // Linear Pick Seeds algorithm for Lienar Cost Algorithm.
 //
-void RTree::linear_pick_seeds(Entry* entry_list, int len, int& m1, int& m2)
+void RTree::linear_pick_seeds(const Entry* entry_list, int len, int& m1, int& m2)
 {
-	int iminx = 0, imaxx = 0, iminy = 0, imaxy = 0;    
 	int dim = entry_list[0].get_mbr().get_dim();
 
 	//extreme pairs for each dimension
-	//for a pair, first element is the entry with highest low side, second is the entry with lowest high side
-	vector<pair<int,int> > extremePairs;
-	//initialize entreme pairs
-	for (int i = 0; i < dim; i++)
+	//seed_low[j] is the entry with highest low side, seed_high[j] is the entry with lowest high side
+	//the extent of all entries on each dimension is tracked in the same pass
+	int* seed_low = split_seeds;
+	int* seed_high = split_seeds + dim;
+	for (int j = 0; j < dim; j++)
 	{
-		pair<int, int> extremePair(0, 0);//the first entry by default
-		extremePairs.push_back(extremePair);
+		seed_low[j] = 0;//the first entry by default
+		seed_high[j] = 0;
+		split_extent[2*j] = entry_list[0].get_mbr().get_lowestValue_at(j);
+		split_extent[2*j+1] = entry_list[0].get_mbr().get_highestValue_at(j);
 	}
 	// pick the two entries with the largest gap on each dimension
 	//for every entry
 	for (int i = 1; i < len; i++) {
+		const BoundingBox& ithMBR = entry_list[i].get_mbr();
 		//for every dimension
 		for (int j = 0; j < dim; j++)
 		{
-			pair<int, int> extremePair = extremePairs[j];
-			BoundingBox ithMBR = entry_list[i].get_mbr();
-
 			//get highest low side on j-th dimension
 			//the MBR of entry that has highest low side on dimension j
-			BoundingBox highestLowEntryMBR = entry_list[extremePair.first].get_mbr();
+			const BoundingBox& highestLowEntryMBR = entry_list[seed_low[j]].get_mbr();
+			//the MBR of entry that has lowest high side on dimension j
+			const BoundingBox& lowestHighEntryMBR = entry_list[seed_high[j]].get_mbr();
 			if (ithMBR.get_lowestValue_at(j) > highestLowEntryMBR.get_lowestValue_at(j)) {
-				extremePairs[j].first = i;
+				seed_low[j] = i;
 			}
 			else if (ithMBR.get_lowestValue_at(j) == highestLowEntryMBR.get_lowestValue_at(j)) {
 				if (tie_breaking(ithMBR, highestLowEntryMBR)) {
-					extremePairs[j].first = i;
+					seed_low[j] = i;
 				}
 			}
 
 			//get lowest high side on j-th dimension
-			BoundingBox lowestHighEntryMBR = entry_list[extremePair.second].get_mbr();
 			if (ithMBR.get_highestValue_at(j) < lowestHighEntryMBR.get_highestValue_at(j))
 			{
-				extremePairs[j].second = i;
+				seed_high[j] = i;
 			}
 			else if (ithMBR.get_highestValue_at(j) == lowestHighEntryMBR.get_highestValue_at(j))
 			{
 				if (tie_breaking(ithMBR, lowestHighEntryMBR)) {
-					extremePairs[j].second = i;
+					seed_high[j] = i;
 				}
 			}
+
+			split_extent[2*j] = min(split_extent[2*j], ithMBR.get_lowestValue_at(j));
+			split_extent[2*j+1] = max(split_extent[2*j+1], ithMBR.get_highestValue_at(j));
 		}
 
 	}
-	BoundingBox box = get_mbr(entry_list, len);
 	
 	//for each dimension, find the greatest normalized separation and store the respective pair in m1 and m2
 	//init
@@ -165,22 +412,21 @@ void RTree::linear_pick_seeds(Entry* entry_list, int len, int& m1, int& m2)
 	for (int j = 0; j < dim; j++)
 	{
 		double normalizedJdimSeparation = 0;
-		double delta = box.get_highestValue_at(j) - box.get_lowestValue_at(j);
+		double delta = split_extent[2*j+1] - split_extent[2*j];
 
-		pair<int, int> extremePair = extremePairs[j];
 		if (delta != 0)
 		{
 			normalizedJdimSeparation = 
-				abs(entry_list[extremePair.first].get_mbr().get_lowestValue_at(j) 
-					- entry_list[extremePair.second].get_mbr().get_highestValue_at(j)) * 1.0 
+				abs(entry_list[seed_low[j]].get_mbr().get_lowestValue_at(j) 
+					- entry_list[seed_high[j]].get_mbr().get_highestValue_at(j)) * 1.0 
 				/ delta;
 		}
 		if (greatestNormalizedSeparation - normalizedJdimSeparation >= -EPSILON)
 		{
 		}
 		else {
-			m1 = extremePair.first;
-			m2 = extremePair.second;
+			m1 = seed_low[j];
+			m2 = seed_high[j];
 			greatestNormalizedSeparation = normalizedJdimSeparation;
 		}
 	}
@@ -197,23 +443,83 @@ void RTree::linear_pick_seeds(Entry* entry_list, int len, int& m1, int& m2)
 }
 
 
+//
+// Check whether record ``i'' of ``leaf'' intersects ``mbr''.
+// Point records compare dim values instead of the 2 * dim of a rectangle.
+//
+bool RTree::record_overlap(const RTNode* leaf, int i, const BoundingBox& mbr) const
+{
+	if (leaf->boxes)
+		return mbr.is_intersected(leaf->get_point(i), leaf->get_high(i));
+	return mbr.contains_point(leaf->get_point(i));
+}
+
+
+//
+// Count the records in the buffer of ``node'' that match ``mbr'' under ``pred'', see set_insert_buffer().
+//
+int RTree::count_buffered(const RTNode* node, const BoundingBox& mbr, RangePredicate pred) const
+{
+	int cnt = 0;
+	for (int i = 0; i < node->buffer.size(); i++) {
+		const BoundingBox& record_mbr = node->buffer[i].get_mbr();
+		if (pred == CONTAINED_IN ? mbr.contains(record_mbr) : overlap(record_mbr, mbr))
+			cnt++;
+	}
+	return cnt;
+}
+
+
+//
+// Return the index of a record in the buffer of ``node'' that intersects ``mbr'', or -1.
+//
+int RTree::find_buffered(const RTNode* node, const BoundingBox& mbr) const
+{
+	for (int i = 0; i < node->buffer.size(); i++) {
+		if (overlap(node->buffer[i].get_mbr(), mbr))
+			return i;
+	}
+	return -1;
+}
+
+
+//
+// Check whether a record with exactly the MBR ``mbr'' is stored below ``node''.
+//
+bool RTree::find_record(const RTNode* node, const BoundingBox& mbr)
+{
+	if (node->level == 0) {
+		for (int i = 0; i < node->entry_num; i++) {
+			if (mbr.is_equal(node->get_point(i), node->get_high(i)))
+				return true;
+		}
+		return false;
+	}
+	for (int i = 0; i < node->entry_num; i++) {
+		if (node->entries[i].get_mbr().contains(mbr) && find_record(node->entries[i].get_ptr(), mbr))
+			return true;
+	}
+	return false;
+}
+
+
 //
 // Find the leaf node and delete the ``record''.
+// The record must match exactly, so only subtrees containing its MBR are searched.
 //
 RTNode* RTree::find_leaf(RTNode* node, RTNode** stack, int* entry_idx, int& stack_size, const Entry& record)
 {
 	if (node->level == 0) {
 		for (int i = 0; i < node->entry_num; i++) {
-			if (overlap(node->entries[i].get_mbr(), record.get_mbr())) {
-				swap_entry(node->entries, i, node->entry_num-1); // move the record the the end to indicate ``deleted''
-				node->entry_num--;
+			if (record.get_mbr().is_equal(node->get_point(i), node->get_high(i))) {
+				detach_entry(node, i); // move the record the the end to indicate ``deleted
 				return node;
 			}
 		}
 	}
 	else {
 		for (int i = 0; i < node->entry_num; i++) {
-			if (overlap(node->entries[i].get_mbr(), record.get_mbr())) {
+			if (node->entries[i].get_mbr().contains(record.get_mbr())) {
 				stack[stack_size] = node;
 				entry_idx[stack_size] = i;
 				stack_size++;
@@ -229,38 +535,90 @@ RTNode* RTree::find_leaf(RTNode* node, RTNode** stack, int* entry_idx, int& stac
 }
 
 //
-// Find the node to insert the new entry ``e'' at the specified level ``dest_level''.
-// In particular, find the leaf node for new record if ``dest_level == 0''.
+// Find the leaf node holding the record with exactly the MBR ``mbr'' and its ``slot'' there,
+// leaving the path in ``stack'' as the function above does, without deleting the record. In the
+// same traversal, look for a record with exactly the MBR ``target'' unless it is NULL: the
+// subtrees covering only ``target'' are searched by find_record(). If one is found, ``taken'' is
+// set and NULL returned.
 //
-RTNode* RTree::choose_leaf(RTNode** stack, int* entry_idx, int& stack_size, const Entry& e, int dest_level)
+RTNode* RTree::find_leaf(RTNode* node, RTNode** stack, int* entry_idx, int& stack_size, const BoundingBox& mbr, const BoundingBox* target, int& slot, bool& taken)
 {
-	RTNode* node = root;
-	while (node->level != dest_level) {
-		int min_idx = 0;
-		int min_enlargement = area_inc(node->entries[0].get_mbr(), e.get_mbr());
-		for (int i = 1; i < node->entry_num; i++) {
-			// compare with other entries
-			int cur_enlargement = area_inc(node->entries[i].get_mbr(), e.get_mbr());
-			if (cur_enlargement < min_enlargement) {
+	RTNode* leaf = NULL;
+	if (node->level == 0) {
+		for (int i = 0; i < node->entry_num; i++) {
+			if (target != NULL && target->is_equal(node->get_point(i), node->get_high(i))) {
+				taken = true;
+				return NULL;
+			}
+			if (leaf == NULL && mbr.is_equal(node->get_point(i), node->get_high(i))) {
+				leaf = node;
+				slot = i;
+			}
+		}
+		return leaf;
+	}
+	for (int i = 0; i < node->entry_num && !taken; i++) {
+		const BoundingBox& child_mbr = node->entries[i].get_mbr();
+		if (leaf == NULL && child_mbr.contains(mbr)) {
+			stack[stack_size] = node;
+			entry_idx[stack_size] = i;
+			stack_size++;
+			leaf = find_leaf(node->entries[i].get_ptr(), stack, entry_idx, stack_size, mbr, target, slot, taken);
+			if (leaf == NULL) {
+				stack_size--;
+			}
+		}
+		else if (target != NULL && child_mbr.contains(*target)) {
+			taken = find_record(node->entries[i].get_ptr(), *target);
+		}
+	}
+	return taken ? NULL : leaf;
+}
+
+//
+// Return the index of the entry in ``entry_list'' that needs the least area enlargement to include ``mbr''.
+// Ties are resolved by the smaller area, then by tie_breaking().
+//
+int RTree::choose_subtree(const Entry* entry_list, int len, const BoundingBox& mbr)
+{
+	int min_idx = 0;
+	area_t min_enlargement = area_inc(entry_list[0].get_mbr(), mbr);
+	for (int i = 1; i < len; i++) {
+		// compare with other entries
+		area_t cur_enlargement = area_inc(entry_list[i].get_mbr(), mbr);
+		if (cur_enlargement < min_enlargement) {
+			min_idx = i;
+			min_enlargement = cur_enlargement;
+		}
+		else if (cur_enlargement == min_enlargement) {
+			// do not need to change min_enlargement as they are the same.
+			area_t cur_area = area(entry_list[i].get_mbr());
+			area_t min_area = area(entry_list[min_idx].get_mbr());
+			// select the one with min area.
+			if (cur_area < min_area) {
 				min_idx = i;
-				min_enlargement = cur_enlargement;
-			}
-			else if (cur_enlargement == min_enlargement) {
-				// do not need to change min_enlargement as they are the same.
-				int cur_area = area(node->entries[i].get_mbr());
-				int min_area = area(node->entries[min_idx].get_mbr());
-				// select the one with min area.
-				if (cur_area < min_area) {
+			}
+			else if (cur_area == min_area) {
+				// tie breaking
+				if (tie_breaking(entry_list[i].get_mbr(), entry_list[min_idx].get_mbr())) {
 					min_idx = i;
 				}
-				else if (cur_area == min_area) {
-					// tie breaking
-					if (tie_breaking(node->entries[i].get_mbr(), node->entries[min_idx].get_mbr())) {
-						min_idx = i;
-					}
-				}
 			}
 		}
+	}
+	return min_idx;
+}
+
+
+//
+// Find the node to insert the new entry ``e'' at the specified level ``dest_level''.
+// In particular, find the leaf node for new record if ``dest_level == 0''.
+//
+RTNode* RTree::choose_leaf(RTNode** stack, int* entry_idx, int& stack_size, const Entry& e, int dest_level)
+{
+	RTNode* node = root;
+	while (node->level != dest_level) {
+		int min_idx = choose_subtree(node->entries, node->entry_num, e.get_mbr());
 		//this->print_node(node, 4);
 		stack[stack_size] = node;
 		entry_idx[stack_size] = min_idx;
@@ -271,6 +629,22 @@ RTNode* RTree::choose_leaf(RTNode** stack, int* entry_idx, int& stack_size, cons
 }
 
 
+//
+// Enlarge the MBRs on the insertion path by ``mbr'', bottom-up.
+// Stop at the first ancestor entry that already covers ``mbr'' since nothing above it changes.
+//
+void RTree::enlarge_path(RTNode** stack, int* entry_idx, int size, const BoundingBox& mbr)
+{
+	while (size > 0) {
+		size--;
+		Entry& parent_entry = stack[size]->entries[entry_idx[size]];
+		if (parent_entry.get_mbr().contains(mbr))
+			return;
+		parent_entry.group_mbr(mbr);
+	}
+}
+
+
 //
 // Adjust the MBR of nodes involved in insertion.
 //
@@ -280,7 +654,7 @@ void RTree::adjust_tree(RTNode** stack, int* entry_idx, int size)
 		size--;
 		RTNode* node = stack[size]->entries[entry_idx[size]].get_ptr();
 		
-		stack[size]->entries[entry_idx[size]].set_mbr(get_mbr(node->entries, node->entry_num));
+		stack[size]->entries[entry_idx[size]].set_mbr(get_mbr(node));
 	}
 }
 
@@ -289,19 +663,24 @@ void RTree::adjust_tree(RTNode** stack, int* entry_idx, int size)
 // Helper function for query_range(), with range specified in ``mbr''.
 // Return: number of results in ``result_cnt''.
 //		number of R-tree nodes traveled in ``node_traveled''.
-void RTree::query_range(const RTNode* node, const BoundingBox mbr, int& result_cnt, int& node_traveled)
+void RTree::query_range(const RTNode* node, const BoundingBox& mbr, RangePredicate pred, int& result_cnt, int& node_traveled)
 {
 	node_traveled++;
+	read_page(page_buffer, node->page);
 	if (node->level == 0) {
 		for (int i = 0;i < node->entry_num;i++) {
-			if (overlap(node->entries[i].get_mbr(), mbr)) {
+			bool match = (pred == CONTAINED_IN && node->boxes)
+				? mbr.contains(node->get_point(i), node->get_high(i))
+				: record_overlap(node, i, mbr);
+			if (match) {
 				result_cnt++;
 			}
 		}
 	} else {
+		result_cnt += count_buffered(node, mbr, pred);
 		for (int i = 0;i < node->entry_num; i++) {
 			if (overlap(node->entries[i].get_mbr(), mbr)) {
-				query_range(node->entries[i].get_ptr(), mbr, result_cnt, node_traveled);
+				query_range(node->entries[i].get_ptr(), mbr, pred, result_cnt, node_traveled);
 			}
 		}
 	}
@@ -309,19 +688,25 @@ void RTree::query_range(const RTNode* node, const BoundingBox mbr, int& result_c
 
 
 //
-// Helper function for point_query().
+// Helper function for point_query(). A rectangle record matches if it contains the point.
 //
 bool RTree::query_point(const RTNode* node, const BoundingBox& mbr, Entry& result)
 {
+	read_page(page_buffer, node->page);
 	if (node->level == 0) {
 		for (int i = 0; i < node->entry_num; i++) {
-			if (overlap(node->entries[i].get_mbr(), mbr)) {
-				result = node->entries[i];
+			if (record_overlap(node, i, mbr)) {
+				node->get_record(i, result);
 				return true;
 			}
 		}
 	}
 	else {
+		int k = find_buffered(node, mbr);
+		if (k >= 0) {
+			result = node->buffer[k];
+			return true;
+		}
 		for (int i = 0; i < node->entry_num; i++) {
 			if (overlap(node->entries[i].get_mbr(), mbr)) {
 				if (query_point(node->entries[i].get_ptr(), mbr, result)) {
@@ -334,16 +719,241 @@ bool RTree::query_point(const RTNode* node, const BoundingBox& mbr, Entry& resul
 }	
 
 
-bool RTree::insert(const vector<int>& coordinate, int rid)
+//
+// Iterative query_range() with an explicit stack of the nodes still to visit.
+// Children that qualify are prefetched when pushed, and the entries of the next node to visit
+// are prefetched while the current one is scanned, so the misses overlap the work.
+// Visits the same nodes as the recursive version, which is kept for comparison.
+//
+void RTree::query_range_iterative(const BoundingBox& mbr, RangePredicate pred, int& result_cnt, int& node_traveled, QueryScratch& scratch) const
 {
-	if (coordinate.size() != this->dimension)
-	{
-		cerr << "R-tree dimensionality inconsistency\n";
+	vector<const RTNode*>& stack = scratch.nodes;
+	stack.clear();
+	stack.push_back(root);
+	while (!stack.empty()) {
+		const RTNode* node = stack.back();
+		stack.pop_back();
+		if (!stack.empty())
+			prefetch_content(stack.back());
+		node_traveled++;
+		read_page(scratch.pages, node->page);
+		if (node->level == 0) {
+			for (int i = 0; i < node->entry_num; i++) {
+				bool match = (pred == CONTAINED_IN && node->boxes)
+					? mbr.contains(node->get_point(i), node->get_high(i))
+					: record_overlap(node, i, mbr);
+				if (match) {
+					result_cnt++;
+				}
+			}
+		} else {
+			result_cnt += count_buffered(node, mbr, pred);
+			for (int i = node->entry_num - 1; i >= 0; i--) {
+				if (overlap(node->entries[i].get_mbr(), mbr)) {
+					const RTNode* child = node->entries[i].get_ptr();
+					prefetch(child);
+					stack.push_back(child);
+				}
+			}
+		}
+	}
+}
+
+
+//
+// Iterative query_point(). Children are pushed in reverse so they are visited in the same order,
+// and the same record is reported, as in the recursive version.
+//
+bool RTree::query_point_iterative(const BoundingBox& mbr, Entry& result, QueryScratch& scratch) const
+{
+	vector<const RTNode*>& stack = scratch.nodes;
+	stack.clear();
+	stack.push_back(root);
+	while (!stack.empty()) {
+		const RTNode* node = stack.back();
+		stack.pop_back();
+		if (!stack.empty())
+			prefetch_content(stack.back());
+		read_page(scratch.pages, node->page);
+		if (node->level == 0) {
+			for (int i = 0; i < node->entry_num; i++) {
+				if (record_overlap(node, i, mbr)) {
+					node->get_record(i, result);
+					return true;
+				}
+			}
+		} else {
+			int k = find_buffered(node, mbr);
+			if (k >= 0) {
+				result = node->buffer[k];
+				return true;
+			}
+			for (int i = node->entry_num - 1; i >= 0; i--) {
+				if (overlap(node->entries[i].get_mbr(), mbr)) {
+					const RTNode* child = node->entries[i].get_ptr();
+					prefetch(child);
+					stack.push_back(child);
+				}
+			}
+		}
+	}
+	return false;
+}
+
+
+//
+// Range queries of ``ranges''. On a frozen tree they run interleaved, see query_frozen_interleaved(),
+// otherwise one after the other.
+// Return: the number of results and of nodes visited of each query, as query_range() does.
+//
+void RTree::query_range_batch(const vector<BoundingBox>& ranges, vector<int>& result_count, vector<int>& node_travelled, RangePredicate pred)
+{
+	result_count.assign(ranges.size(), 0);
+	node_travelled.assign(ranges.size(), 0);
+	if (frozen != NULL) {
+		query_frozen_interleaved(&ranges, NULL, pred, result_count, node_travelled, NULL);
+		return;
+	}
+	for (int i = 0; i < ranges.size(); i++) {
+		query_range(ranges[i], result_count[i], node_travelled[i], pred);
+	}
+}
+
+
+//
+// Point queries of ``coordinates''. On a frozen tree they run interleaved, see
+// query_frozen_interleaved(), otherwise one after the other.
+// Return: the number of points with a record; ``found[i]'' tells if ``results[i]'' holds the
+//		record query_point() reports for the i-th point.
+//
+int RTree::query_point_batch(const vector<vector<coord_t> >& coordinates, vector<Entry>& results, vector<bool>& found)
+{
+	int found_cnt = 0;
+	results.resize(coordinates.size());
+	found.assign(coordinates.size(), false);
+	if (frozen != NULL) {
+		vector<int> result_cnt, node_cnt;
+		query_frozen_interleaved(NULL, &coordinates, INTERSECTS, result_cnt, node_cnt, &results);
+		for (int i = 0; i < coordinates.size(); i++) {
+			found[i] = result_cnt[i] != 0;
+			found_cnt += result_cnt[i];
+		}
+		return found_cnt;
+	}
+	for (int i = 0; i < coordinates.size(); i++) {
+		if (query_point(coordinates[i], results[i])) {
+			found[i] = true;
+			found_cnt++;
+		}
+	}
+	return found_cnt;
+}
+
+
+//
+// Range queries of ``ranges'' answered by shared traversals, each for up to 64 queries at a time.
+// A traversal carries a bitmask of the queries still active below each node: every entry is tested
+// against the active queries and the child is visited once, for the queries its MBR overlaps.
+// Results and visited nodes are counted per query as query_range() counts them, on the frozen
+// tree as well, and the records waiting in buffers are counted for each active query.
+// Return: the number of nodes the shared traversals visited.
+//
+int RTree::query_range_shared(const vector<BoundingBox>& ranges, vector<int>& result_count, vector<int>& node_travelled, RangePredicate pred)
+{
+	int n = ranges.size();
+	result_count.assign(n, 0);
+	node_travelled.assign(n, 0);
+
+	int shared_travelled = 0;
+	vector<pair<const RTNode*, unsigned long long> > stack;
+	for (int first = 0; first < n; first += 64) {
+		int group = min(64, n - first);
+		const BoundingBox* box = &ranges[first];
+		if (frozen != NULL) {
+			shared_travelled += query_range_shared_frozen(box, group, pred, &result_count[first], &node_travelled[first]);
+			continue;
+		}
+		unsigned long long all = group == 64 ? ~0ULL : (1ULL << group) - 1;
+		stack.push_back(make_pair((const RTNode*)root, all));
+		while (!stack.empty()) {
+			const RTNode* node = stack.back().first;
+			unsigned long long active = stack.back().second;
+			stack.pop_back();
+			if (!stack.empty())
+				prefetch_content(stack.back().first);
+			shared_travelled++;
+			read_page(page_buffer, node->page);
+			for (int q = 0; q < group; q++) {
+				if (active >> q & 1)
+					node_travelled[first + q]++;
+			}
+			if (node->level == 0) {
+				for (int i = 0; i < node->entry_num; i++) {
+					for (int q = 0; q < group; q++) {
+						if (!(active >> q & 1))
+							continue;
+						bool match = (pred == CONTAINED_IN && node->boxes)
+							? box[q].contains(node->get_point(i), node->get_high(i))
+							: record_overlap(node, i, box[q]);
+						if (match)
+							result_count[first + q]++;
+					}
+				}
+			} else {
+				for (int q = 0; q < group; q++) {
+					if (active >> q & 1)
+						result_count[first + q] += count_buffered(node, box[q], pred);
+				}
+				for (int i = node->entry_num - 1; i >= 0; i--) {
+					const BoundingBox& mbr = node->entries[i].get_mbr();
+					unsigned long long child_active = 0;
+					for (int q = 0; q < group; q++) {
+						if ((active >> q & 1) && overlap(mbr, box[q]))
+							child_active |= 1ULL << q;
+					}
+					if (child_active != 0) {
+						const RTNode* child = node->entries[i].get_ptr();
+						prefetch(child);
+						stack.push_back(make_pair(child, child_active));
+					}
+				}
+			}
+		}
 	}
+	return shared_travelled;
+}
+
+
+bool RTree::insert(const vector<coord_t>& coordinate, int rid)
+{
 	//a point is also modeled by a mbr.
 	BoundingBox mbr(coordinate, coordinate);
+	return insert(mbr, rid);
+}
+
+
+//
+// Insert a rectangle record. The leaves switch to rectangle records on the first one that is not a point.
+//
+bool RTree::insert(const BoundingBox& mbr, int rid)
+{
+	if (mbr.get_dim() != this->dimension)
+	{
+		cerr << "R-tree dimensionality inconsistency\n";
+	}
+	if (!mbr.is_valid()) {
+		return false;
+	}
+	thaw();
+	if (!box_records && !mbr.is_equal(mbr.get_lowest().data(), mbr.get_lowest().data())) {
+		box_records = true;
+		widen_leaves(root);
+	}
 	Entry e(mbr, rid);
-	return insert(e, 0);
+	bool inserted = buffer_capacity > 0 ? insert_buffered(e) : insert(e, 0);
+	if (inserted)
+		summary.changes++;
+	return inserted;
 }
 
 
@@ -352,247 +962,3185 @@ bool RTree::insert(const vector<int>& coordinate, int rid)
 //
 bool RTree::insert(const Entry& e, int dest_level)
 {
-	Entry dummy;
-	if (dest_level == 0 && query_point(root, e.get_mbr(), dummy)) {
+	if (dest_level == 0 && find_record(root, e.get_mbr())) {
 		return false; 
 	} 
 
 	// stack contains the path to the leaf (not including the leaf node).
 	RTNode** stack = new RTNode*[root->level];
-	int stack_size = 0;
 	// entry_idx contains the index of each entry in the node from the path.
 	int* entry_idx = new int[root->level];
 
+	insert(e, dest_level, stack, entry_idx);
+
+	delete []stack;
+	delete []entry_idx;
+	return true;
+}
+
+
+//
+// Insert ``e'' at ``dest_level'' without the duplicate check, using the caller's path buffers.
+// ``stack'' and ``entry_idx'' must hold at least root->level elements.
+//
+void RTree::insert(const Entry& e, int dest_level, RTNode** stack, int* entry_idx)
+{
+	if (engine == HILBERT_ENGINE) {
+		hilbert_insert(e, dest_level, stack, entry_idx);
+		return;
+	}
+	int stack_size = 0;
 	RTNode* leaf = choose_leaf(stack, entry_idx, stack_size, e, dest_level);
 	
 	// check if there is space for the new entry
-	if (leaf->entry_num < max_entry_num) {
-		leaf->entries[leaf->entry_num] = e;//pointer
-		leaf->entry_num++;
-		/*if (stack_size != 0)
-		{
-			this->print_node(stack[0],4);
-		}	*/
-		adjust_tree(stack, entry_idx, stack_size);
-		/*if (stack_size != 0)
-		{
-			this->print_node(stack[0],4);
-		}	*/
-		delete[] stack;
-		delete[] entry_idx;
+	if (leaf->entry_num < leaf->size) {
+		append_entry(leaf, e);
+		enlarge_path(stack, entry_idx, stack_size, e.get_mbr());
+		return;
+	}
+
+	
+	// split is needed.
+	bool split = true;
+	RTNode* node = leaf;
+	Entry new_entry = e;
+	while (split) {
+		// the split writes the MBR of ``node'' into its entry in the parent
+		RTNode* parent;
+		int idx;
+		if (stack_size == 0) {
+			// root reached.
+			parent = create_node(node->level+1);
+			parent->entries[0].set_ptr(node);
+			parent->entry_num = 1;
+			root = parent;
+			idx = 0;
+		}
+		else {
+			stack_size--;
+			parent = stack[stack_size];
+			idx = entry_idx[stack_size];
+		}
+		split_node(node, new_entry, parent->entries[idx]);
+
+		// two nodes now. go to a higher level
+		if (parent->entry_num < parent->size) {
+			take_entry(parent, new_entry);
+			split = false;
+		}
+		else
+			node = parent;
+	}
+	adjust_tree(stack, entry_idx, stack_size);
+}
+
+
+//
+// Hilbert value of the center of the box [low, high], the key of the Hilbert engine.
+// Integer coordinates are offset into the frame [-2^hilbert_bits, 2^hilbert_bits) of every
+// dimension, see widen_hilbert_frame(); floating-point ones are mapped in order onto 64-bit
+// integers. The key keeps the top bits, at most 64 in total.
+//
+unsigned long long RTree::hilbert_value(const coord_t* low, const coord_t* high)
+{
+	int width = numeric_limits<coord_t>::is_integer ? hilbert_bits + 1 : 64;
+	int key_bits = min(width, min(32, 64 / dimension));
+	vector<unsigned int> cell(dimension);
+	for (int j = 0; j < dimension; j++) {
+		long double center = ((long double)low[j] + high[j]) / 2;
+		unsigned long long v;
+		if (numeric_limits<coord_t>::is_integer) {
+			v = (unsigned long long)(long long)floorl(center) + (1ULL << hilbert_bits);
+		}
+		else {
+			double d = (double)center;
+			memcpy(&v, &d, sizeof(v));
+			v = (v >> 63) ? ~v : v | (1ULL << 63);
+		}
+		cell[j] = (unsigned int)(v >> (width - key_bits));
+	}
+	return hilbert_key(cell, key_bits);
+}
+
+//
+// Hilbert value of entry ``i'' of ``node'': that of the record in a leaf, the largest one below
+// the child otherwise.
+//
+unsigned long long RTree::hilbert_value(const RTNode* node, int i)
+{
+	if (node->level == 0)
+		return hilbert_value(node->get_point(i), node->get_high(i));
+	return node->entries[i].get_ptr()->hilbert_max;
+}
+
+
+//
+// Grow the frame of the Hilbert values of integer coordinates until it holds ``mbr''.
+// Return true if it grew: the values change with the frame, so the nodes must be sorted again.
+//
+bool RTree::widen_hilbert_frame(const BoundingBox& mbr)
+{
+	if (!numeric_limits<coord_t>::is_integer)
+		return false;
+	int bits = hilbert_bits;
+	for (int j = 0; j < dimension; j++) {
+		long long low = (long long)mbr.get_lowestValue_at(j);
+		long long high = (long long)mbr.get_highestValue_at(j);
+		while (bits < 63 && (low < -(1LL << bits) || high >= (1LL << bits)))
+			bits++;
+	}
+	if (bits == hilbert_bits)
+		return false;
+	hilbert_bits = bits;
+	return true;
+}
+
+
+//
+// Sort the entries of every node below ``node'' into Hilbert order and recompute the largest
+// Hilbert value of each node.
+//
+void RTree::hilbert_sort(RTNode* node)
+{
+	if (node->entry_num == 0)
+		return;
+	vector<pair<unsigned long long, int> > order(node->entry_num);
+	for (int i = 0; i < node->entry_num; i++) {
+		if (node->level != 0)
+			hilbert_sort(node->entries[i].get_ptr());
+		order[i] = make_pair(hilbert_value(node, i), i);
+	}
+	sort(order.begin(), order.end());
+	vector<Entry> items(node->entry_num);
+	for (int i = 0; i < node->entry_num; i++) {
+		if (node->level == 0)
+			node->get_record(order[i].second, items[i]);
+		else
+			items[i] = node->entries[order[i].second];
+	}
+	for (int i = 0; i < node->entry_num; i++) {
+		if (node->level == 0)
+			node->set_record(i, items[i]);
+		else
+			node->entries[i] = items[i];
+	}
+	node->hilbert_max = order.back().first;
+}
+
+
+//
+// Hilbert value of an entry ``e'' of a node at ``level'', see hilbert_value(const RTNode*, int).
+//
+unsigned long long RTree::hilbert_value(const Entry& e, int level)
+{
+	if (level == 0)
+		return hilbert_value(e.get_mbr().get_lowest().data(), e.get_mbr().get_highest().data());
+	return e.get_ptr()->hilbert_max;
+}
+
+
+//
+// Spread the entries of the nodes of ``group'' and ``e'', of Hilbert value ``key'', evenly over
+// these nodes in Hilbert order, adding a node to ``group'' first if they do not fit.
+// The nodes are next to each other in their parent, so their entries are already in order.
+//
+void RTree::hilbert_redistribute(vector<RTNode*>& group, const Entry& e, unsigned long long key)
+{
+	int level = group[0]->level;
+	vector<Entry> items;
+	int capacity = 0;
+	for (int g = 0; g < group.size(); g++) {
+		RTNode* node = group[g];
+		capacity += node->size;
+		for (int i = 0; i < node->entry_num; i++) {
+			items.push_back(Entry());
+			if (level == 0)
+				node->get_record(i, items.back());
+			else
+				items.back().swap(node->entries[i]);
+		}
+		node->entry_num = 0;
+	}
+	int low = 0, high = items.size();
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (hilbert_value(items[mid], level) <= key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	items.insert(items.begin() + low, e);
+	if (items.size() > capacity)
+		group.push_back(create_node(level));
+
+	int n = items.size();
+	int k = group.size();
+	for (int g = 0, begin = 0; g < k; g++) {
+		int end = begin + n / k + (g < n % k ? 1 : 0);
+		for (int i = begin; i < end; i++) {
+			take_entry(group[g], items[i]);
+		}
+		group[g]->hilbert_max = hilbert_value(group[g], group[g]->entry_num - 1);
+		begin = end;
+	}
+}
+
+
+//
+// Enlarge the MBRs on the insertion path of the Hilbert engine by ``mbr'' and refresh the
+// largest Hilbert values, bottom-up. Stop where neither changes.
+//
+void RTree::hilbert_path(RTNode** stack, int* entry_idx, int size, const BoundingBox& mbr)
+{
+	while (size > 0) {
+		size--;
+		RTNode* parent = stack[size];
+		Entry& parent_entry = parent->entries[entry_idx[size]];
+		bool covered = parent_entry.get_mbr().contains(mbr);
+		if (!covered)
+			parent_entry.group_mbr(mbr);
+		unsigned long long last = parent->entries[parent->entry_num - 1].get_ptr()->hilbert_max;
+		if (covered && parent->hilbert_max == last)
+			return;
+		parent->hilbert_max = last;
+	}
+}
+
+
+//
+// Insertion of the Hilbert engine (Kamel and Faloutsos, "Hilbert R-tree: an improved R-tree
+// using fractals", VLDB 1994). The entries of every node are kept in the order of their Hilbert
+// values, and every node keeps the largest value below it. ``e'' descends into the first child
+// whose largest value is not below its own and is placed in order. A full node shares its entries
+// with a cooperating sibling next to it, and only when both are full are the two split into
+// three, so nodes stay about two thirds full where a split leaves halves.
+//
+void RTree::hilbert_insert(const Entry& e, int dest_level, RTNode** stack, int* entry_idx)
+{
+	unsigned long long key;
+	if (dest_level == 0) {
+		if (widen_hilbert_frame(e.get_mbr()))
+			hilbert_sort(root);
+		key = hilbert_value(e.get_mbr().get_lowest().data(), e.get_mbr().get_highest().data());
+	}
+	else {
+		key = e.get_ptr()->hilbert_max;
+	}
+	int stack_size = 0;
+	RTNode* node = root;
+	while (node->level != dest_level) {
+		int i = 0;
+		while (i < node->entry_num - 1 && node->entries[i].get_ptr()->hilbert_max < key)
+			i++;
+		stack[stack_size] = node;
+		entry_idx[stack_size] = i;
+		stack_size++;
+		node = node->entries[i].get_ptr();
+	}
+
+	Entry item = e;
+	while (node->entry_num == node->size) {
+		vector<RTNode*> group(1, node);
+		if (stack_size == 0) {
+			// the root splits into two
+			hilbert_redistribute(group, item, key);
+			RTNode* new_root = create_node(node->level + 1);
+			for (int g = 0; g < 2; g++) {
+				new_root->entries[g].set_mbr(get_mbr(group[g]));
+				new_root->entries[g].set_ptr(group[g]);
+			}
+			new_root->entry_num = 2;
+			new_root->hilbert_max = group[1]->hilbert_max;
+			root = new_root;
+			return;
+		}
+		RTNode* parent = stack[stack_size - 1];
+		int first = entry_idx[stack_size - 1];
+		int len = min(2, parent->entry_num);
+		if (len == 2) {
+			first = min(first, parent->entry_num - 2);
+			group[0] = parent->entries[first].get_ptr();
+			group.push_back(parent->entries[first + 1].get_ptr());
+		}
+		hilbert_redistribute(group, item, key);
+		for (int g = 0; g < len; g++) {
+			parent->entries[first + g].set_mbr(get_mbr(group[g]));
+		}
+		if (group.size() == len) {
+			parent->hilbert_max = parent->entries[parent->entry_num - 1].get_ptr()->hilbert_max;
+			hilbert_path(stack, entry_idx, stack_size - 1, e.get_mbr());
+			return;
+		}
+		// a node was added: insert it into the parent
+		RTNode* added = group.back();
+		item.set_mbr(get_mbr(added));
+		item.set_ptr(added);
+		key = added->hilbert_max;
+		node = parent;
+		stack_size--;
+	}
+
+	int low = 0, high = node->entry_num;
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (hilbert_value(node, mid) <= key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	append_entry(node, item);
+	for (int i = node->entry_num - 1; i > low; i--) {
+		if (node->level == 0)
+			node->swap_record(i, i - 1);
+		else
+			node->entries[i].swap(node->entries[i - 1]);
+	}
+	node->hilbert_max = hilbert_value(node, node->entry_num - 1);
+	hilbert_path(stack, entry_idx, stack_size, e.get_mbr());
+}
+
+
+//
+// Simulate the disk I/O of the queries: each node is stored in a page of its own, and the nodes
+// the queries visit are read through a buffer of ``capacity'' pages with LRU replacement, see
+// PageBuffer. The page accesses and the reads that missed the buffer are counted across queries,
+// from zero again on every call; 0 turns the simulation off. A frozen tree stores a node per slot,
+// and the buffer starts empty when the tree is frozen or thawed. Updates are not simulated.
+//
+void RTree::set_page_buffer(int capacity)
+{
+	delete page_buffer;
+	page_buffer = capacity > 0 ? new PageBuffer(capacity) : NULL;
+	query_scratch.pages = page_buffer;
+}
+
+//
+// The buffer of the I/O simulation, NULL if it is off; see set_page_buffer().
+//
+const PageBuffer* RTree::get_page_buffer() const
+{
+	return page_buffer;
+}
+
+
+//
+// Turn buffer-tree mode on with room for ``capacity'' records in the buffer of every non-leaf
+// node, or off with 0. In buffer-tree mode insert() appends the record to the buffer of the root.
+// A buffer that overflows is emptied into the buffers of the children (or into the leaves at
+// level 1) a whole batch at a time, so each node on the way is visited once per batch instead
+// of once per record. The MBR of a node covers its buffered records, and query_range() and
+// query_point() look into the buffers they pass, as deletions and updates do for their record;
+// other operations first push every buffered record down with flush_buffers().
+// Instead of a search of the tree, duplicates are found in the set of the keys of all records,
+// which the mode keeps up to date.
+//
+void RTree::set_insert_buffer(int capacity)
+{
+	if (capacity > 0 && engine == HILBERT_ENGINE) {
+		cerr << "Buffer-tree mode is not available with the Hilbert engine\n";
+		return;
+	}
+	if (capacity <= 0) {
+		flush_buffers();
+		record_keys.clear();
+		buffer_capacity = 0;
+		return;
+	}
+	if (buffer_capacity == 0) {
+		thaw();
+		index_keys(root, true);
+	}
+	buffer_capacity = capacity;
+}
+
+
+//
+// Store every record still waiting in a buffer into the leaves.
+//
+void RTree::flush_buffers()
+{
+	if (buffered_num > 0) {
+		flush_root(true);
+	}
+}
+
+
+//
+// Take the record with exactly the MBR ``mbr'' out of the buffers at or below ``node'' into ``record''.
+// As in find_leaf(), only the children whose MBRs contain ``mbr'' are searched, and of those
+// only the ones with records in or below their buffer. The MBRs on the path are refitted.
+//
+bool RTree::erase_buffered(RTNode* node, const BoundingBox& mbr, Entry& record)
+{
+	for (int i = 0; i < node->buffer.size(); i++) {
+		if (node->buffer[i].get_mbr().is_equal(mbr)) {
+			record.swap(node->buffer[i]);
+			node->buffer[i].swap(node->buffer.back());
+			node->buffer.pop_back();
+			buffered_num--;
+			return true;
+		}
+	}
+	for (int i = 0; i < node->entry_num && node->level > 1; i++) {
+		RTNode* child = node->entries[i].get_ptr();
+		if ((!child->buffer.empty() || child->buffered_below) && node->entries[i].get_mbr().contains(mbr)
+			&& erase_buffered(child, mbr, record)) {
+			node->entries[i].set_mbr(get_mbr(child));
+			return true;
+		}
+	}
+	return false;
+}
+
+
+//
+// Move the buffered records of ``node'' and of the nodes below it to ``records'', refitting the
+// MBRs of the children. They still count in buffered_num until rebuffer() gives them back to the tree.
+//
+void RTree::take_buffers(RTNode* node, vector<Entry>& records)
+{
+	for (int i = 0; i < node->buffer.size(); i++) {
+		records.push_back(Entry());
+		records.back().swap(node->buffer[i]);
+	}
+	node->buffer.clear();
+	for (int i = 0; i < node->entry_num && node->level > 1; i++) {
+		RTNode* child = node->entries[i].get_ptr();
+		if (!child->buffer.empty() || child->buffered_below) {
+			take_buffers(child, records);
+			node->entries[i].set_mbr(get_mbr(child));
+		}
+	}
+	node->buffered_below = false;
+}
+
+
+//
+// Give records taken out of the buffers of eliminated nodes back to the tree: to the buffer of
+// the root, flushed if it overflows, or straight into a root leaf.
+//
+void RTree::rebuffer(vector<Entry>& records)
+{
+	for (int k = 0; k < records.size(); k++) {
+		if (root->level == 0) {
+			insert(records[k], 0, NULL, NULL); // no path to keep below a root leaf
+			buffered_num--;
+		}
+		else {
+			root->buffer.push_back(Entry());
+			root->buffer.back().swap(records[k]);
+		}
+	}
+	records.clear();
+	if (root->buffer.size() > buffer_capacity) {
+		flush_root(false);
+	}
+}
+
+
+size_t KeyHash::operator()(const vector<coord_t>& key) const
+{
+	size_t h = 0;
+	for (int i = 0; i < key.size(); i++) {
+		h ^= hash<coord_t>()(key[i]) + 0x9e3779b9 + (h << 6) + (h >> 2);
+	}
+	return h;
+}
+
+
+//
+// The key of a record in ``record_keys'': its lowest, then its highest corner.
+//
+static vector<coord_t> record_key(const coord_t* low, const coord_t* high, int dim)
+{
+	vector<coord_t> key(low, low + dim);
+	key.insert(key.end(), high, high + dim);
+	return key;
+}
+
+static vector<coord_t> record_key(const BoundingBox& mbr)
+{
+	return record_key(&mbr.get_lowest()[0], &mbr.get_highest()[0], mbr.get_dim());
+}
+
+
+//
+// Add the keys of the records below ``node'' to ``record_keys'', or remove them.
+//
+void RTree::index_keys(const RTNode* node, bool add)
+{
+	if (node->level == 0) {
+		for (int i = 0; i < node->entry_num; i++) {
+			vector<coord_t> key = record_key(node->get_point(i), node->get_high(i), dimension);
+			if (add)
+				record_keys.insert(key);
+			else
+				record_keys.erase(key);
+		}
+		return;
+	}
+	for (int i = 0; i < node->buffer.size(); i++) {
+		if (add)
+			record_keys.insert(record_key(node->buffer[i].get_mbr()));
+		else
+			record_keys.erase(record_key(node->buffer[i].get_mbr()));
+	}
+	for (int i = 0; i < node->entry_num; i++) {
+		index_keys(node->entries[i].get_ptr(), add);
+	}
+}
+
+
+//
+// Check whether a record with exactly the MBR ``mbr'' is in the tree. In buffer-tree mode the
+// keys of all records, buffered or not, are at hand.
+//
+bool RTree::has_record(const BoundingBox& mbr)
+{
+	if (buffer_capacity > 0)
+		return record_keys.count(record_key(mbr)) > 0;
+	return find_record(root, mbr);
+}
+
+
+//
+// Buffer-tree insertion of ``e'', see set_insert_buffer(). A root leaf takes it directly.
+//
+bool RTree::insert_buffered(Entry& e)
+{
+	if (!record_keys.insert(record_key(e.get_mbr())).second) {
+		return false;
+	}
+	if (root->level == 0) {
+		insert(e, 0, NULL, NULL); // no path to keep below a root leaf
+		return true;
+	}
+	root->buffer.push_back(Entry());
+	root->buffer.back().swap(e);
+	buffered_num++;
+	if (root->buffer.size() > buffer_capacity) {
+		flush_root(false);
+	}
+	return true;
+}
+
+
+//
+// Empty the buffer of the root, and with ``all'' every buffer below it.
+// The tree grows by a level for as long as the root splits.
+//
+void RTree::flush_root(bool all)
+{
+	vector<Entry> siblings;
+	flush_buffer(root, all, siblings);
+	while (!siblings.empty()) {
+		RTNode* new_root = create_node(root->level + 1);
+		new_root->entries[0].set_mbr(get_mbr(root));
+		new_root->entries[0].set_ptr(root);
+		new_root->entry_num = 1;
+		root = new_root;
+		vector<Entry> extra;
+		extra.swap(siblings);
+		add_children(root, extra, siblings);
+	}
+}
+
+
+//
+// Push the buffered records of ``node'' one level down: into the leaves at level 1, otherwise
+// into the buffers of the children, whose MBRs are enlarged on the way. Children whose buffer
+// overflows are flushed in turn, and with ``all'' every child with records in or below its buffer.
+// The buffer of ``node'' is empty during the flush, so the splits of ``node'' and its descendants
+// never have to share out buffered records. New siblings of ``node'' are returned in ``siblings''
+// as entries for its parent.
+//
+void RTree::flush_buffer(RTNode* node, bool all, vector<Entry>& siblings)
+{
+	vector<Entry> records;
+	records.swap(node->buffer);
+	vector<Entry> extra; // children that did not fit in ``node''
+	if (node->level == 1) {
+		for (int k = 0; k < records.size(); k++) {
+			Entry& e = records[k];
+			int i = choose_subtree(node->entries, node->entry_num, e.get_mbr());
+			RTNode* leaf = node->entries[i].get_ptr();
+			if (leaf->entry_num < leaf->size) {
+				append_entry(leaf, e);
+				node->entries[i].group_mbr(e.get_mbr());
+			}
+			else {
+				split_node(leaf, e, node->entries[i]);
+				add_child(node, e, extra);
+			}
+		}
+		buffered_num -= records.size();
+	}
+	else {
+		for (int k = 0; k < records.size(); k++) {
+			int i = choose_subtree(node->entries, node->entry_num, records[k].get_mbr());
+			node->entries[i].group_mbr(records[k].get_mbr());
+			vector<Entry>& child_buffer = node->entries[i].get_ptr()->buffer;
+			child_buffer.push_back(Entry());
+			child_buffer.back().swap(records[k]);
+		}
+		// new children are appended, so the ones flushed here keep their positions
+		int child_num = node->entry_num;
+		for (int i = 0; i < child_num; i++) {
+			RTNode* child = node->entries[i].get_ptr();
+			if (child->buffer.size() > buffer_capacity || (all && (!child->buffer.empty() || child->buffered_below))) {
+				vector<Entry> child_siblings;
+				flush_buffer(child, all, child_siblings);
+				node->entries[i].set_mbr(get_mbr(child));
+				for (int k = 0; k < child_siblings.size(); k++) {
+					add_child(node, child_siblings[k], extra);
+				}
+			}
+		}
+	}
+	add_children(node, extra, siblings);
+}
+
+
+//
+// Move the entry of a child into ``node'', or into ``extra'' if ``node'' is full.
+//
+void RTree::add_child(RTNode* node, Entry& child, vector<Entry>& extra)
+{
+	if (node->entry_num < node->size) {
+		take_entry(node, child);
+	}
+	else {
+		extra.push_back(Entry());
+		extra.back().swap(child);
+	}
+}
+
+
+//
+// Place the entries ``extra'' into ``node'', splitting it as often as needed. Each entry goes to
+// the part needing the least area enlargement; the parts split off are returned in ``siblings''.
+// Every part then records whether records are buffered below it.
+//
+void RTree::add_children(RTNode* node, vector<Entry>& extra, vector<Entry>& siblings)
+{
+	vector<Entry> parts(1); // the MBR and node of each part
+	parts[0].set_ptr(node);
+	if (!extra.empty()) {
+		parts[0].set_mbr(get_mbr(node));
+	}
+	for (int k = 0; k < extra.size(); k++) {
+		const BoundingBox& mbr = extra[k].get_mbr();
+		int best = 0;
+		for (int p = 1; p < parts.size(); p++) {
+			area_t inc = area_inc(parts[p].get_mbr(), mbr);
+			area_t best_inc = area_inc(parts[best].get_mbr(), mbr);
+			if (inc < best_inc || (inc == best_inc && area(parts[p].get_mbr()) < area(parts[best].get_mbr()))) {
+				best = p;
+			}
+		}
+		RTNode* target = parts[best].get_ptr();
+		if (target->entry_num < target->size) {
+			parts[best].group_mbr(mbr);
+			take_entry(target, extra[k]);
+		}
+		else {
+			split_node(target, extra[k], parts[best]);
+			parts.push_back(Entry());
+			parts.back().swap(extra[k]);
+		}
+	}
+	for (int p = 0; p < parts.size(); p++) {
+		RTNode* part = parts[p].get_ptr();
+		part->buffered_below = false;
+		for (int i = 0; i < part->entry_num && part->level > 1; i++) {
+			const RTNode* child = part->entries[i].get_ptr();
+			if (!child->buffer.empty() || child->buffered_below) {
+				part->buffered_below = true;
+				break;
+			}
+		}
+		if (p > 0) {
+			siblings.push_back(Entry());
+			siblings.back().swap(parts[p]);
+		}
+	}
+}
+
+
+//
+// Hilbert keys of ``points'' over their extent, using at most 64 bits in total.
+// The offsets from the lowest corner are scaled by a power of two: integer coordinates keep
+// their top key_bits bits, floating-point ones are stretched over the whole key range.
+//
+static void hilbert_keys(const vector<vector<coord_t> >& points, int dim, vector<unsigned long long>& keys)
+{
+	int len = points.size();
+	vector<coord_t> low(points[0]);
+	long double range = 0;
+	for (int i = 1; i < len; i++) {
+		for (int j = 0; j < dim; j++) {
+			low[j] = min(low[j], points[i][j]);
+		}
+	}
+	for (int i = 0; i < len; i++) {
+		for (int j = 0; j < dim; j++) {
+			range = max(range, (long double)points[i][j] - low[j]);
+		}
+	}
+	int bits = 0;
+	frexpl(range, &bits); // range < 2^bits
+	int key_bits = min(32, 64 / dim);
+	if (numeric_limits<coord_t>::is_integer) {
+		key_bits = min(key_bits, bits);
+	}
+	keys.resize(len);
+	vector<unsigned int> cell(dim);
+	for (int i = 0; i < len; i++) {
+		for (int j = 0; j < dim; j++) {
+			cell[j] = (unsigned int)ldexpl((long double)points[i][j] - low[j], key_bits - bits);
+		}
+		keys[i] = hilbert_key(cell, key_bits);
+	}
+}
+
+
+//
+// Insert a batch of records, returning the number of records inserted.
+// The batch is cut into chunks no larger than the tree, each chunk is sorted into Hilbert order
+// and routed down the tree in groups, so every touched node is visited and has its MBR adjusted
+// once per chunk. Records already in the tree are skipped, and of the records repeated in the
+// batch only the first is inserted.
+//
+int RTree::insert_batch(const vector<vector<coord_t> >& coordinates, const vector<int>& rids)
+{
+	int len = coordinates.size();
+	if (len == 0) {
+		return 0;
+	}
+	if (rids.size() != len) {
+		cerr << "Number of record ids differs from the number of records\n";
+		return 0;
+	}
+	thaw();
+	for (int i = 0; i < len; i++) {
+		if (coordinates[i].size() != this->dimension)
+		{
+			cerr << "R-tree dimensionality inconsistency\n";
+			return 0;
+		}
+	}
+	if (buffer_capacity > 0 || engine == HILBERT_ENGINE) { // the buffers already batch the insertions, the Hilbert engine orders them
+		int inserted = 0;
+		for (int i = 0; i < len; i++) {
+			inserted += insert(coordinates[i], rids[i]) ? 1 : 0;
+		}
+		return inserted;
+	}
+
+	vector<unsigned long long> keys;
+	hilbert_keys(coordinates, dimension, keys);
+
+	// A chunk larger than the tree would pile up in a few leaves, so chunks grow with the tree.
+	int record_cnt = 0, node_cnt = 0;
+	stat(root, record_cnt, node_cnt);
+	int inserted = 0;
+	for (int begin = 0; begin < len; ) {
+		int end = min(len, begin + max(max_leaf_num, record_cnt));
+		int cnt = insert_chunk(coordinates, rids, keys, begin, end);
+		record_cnt += cnt;
+		inserted += cnt;
+		begin = end;
+	}
+	summary.changes += inserted;
+	return inserted;
+}
+
+
+//
+// Helper function for insert_batch(). Insert records ``begin..end'' of the batch in Hilbert order.
+//
+int RTree::insert_chunk(const vector<vector<coord_t> >& coordinates, const vector<int>& rids, const vector<unsigned long long>& keys, int begin, int end)
+{
+	vector<pair<unsigned long long, int> > order;
+	for (int i = begin; i < end; i++) {
+		order.push_back(make_pair(keys[i], i));
+	}
+	stable_sort(order.begin(), order.end());
+
+	// Equal points have equal keys, so repeats within the chunk are found in the current key run.
+	// Records already in the tree are found on the way down, see below.
+	vector<Entry> records;
+	records.reserve(order.size());
+	int run_start = 0;
+	for (int k = 0; k < order.size(); k++) {
+		if (k > 0 && order[k].first != order[k-1].first) {
+			run_start = records.size();
+		}
+		int i = order[k].second;
+		BoundingBox mbr(coordinates[i], coordinates[i]);
+		bool duplicate = false;
+		for (int r = run_start; r < records.size() && !duplicate; r++) {
+			duplicate = same_entry(records[r], Entry(mbr, rids[i]));
+		}
+		if (!duplicate) {
+			records.push_back(Entry(mbr, rids[i]));
+		}
+	}
+	if (records.empty()) {
+		return 0;
+	}
+
+	vector<int> idx(records.size());
+	for (int i = 0; i < idx.size(); i++) {
+		idx[i] = i;
+	}
+	vector<Entry> group(1);
+	group[0].set_ptr(root);
+	if (root->entry_num > 0) {
+		group[0].set_mbr(get_mbr(root));
+	}
+	int inserted = insert_batch(group, records, &idx[0], idx.size());
+
+	// grow the tree until a single root is left
+	while (group.size() > 1) {
+		vector<Entry> upper(1);
+		upper[0].set_ptr(create_node(root->level+1));
+		for (int i = 0; i < group.size(); i++) {
+			add_entry(upper, group[i]);
+		}
+		root = upper[0].get_ptr();
+		group.swap(upper);
+	}
+	return inserted;
+}
+
+
+//
+// Helper function for insert_batch(). Insert records ``idx[0..len)'' below the node of group[0],
+// except those already stored there, and return the number inserted.
+// A stored copy of a record lies in a leaf whose MBR, and that of every node above, covers it: it
+// is either on the path the record is routed along, where the leaf is checked before the group is
+// added, or below another child covering the record, which is searched before routing. Most
+// records are covered by their routed child only, so the tree is not descended once per record.
+// On return, group[0] holds the adjusted MBR of that node and the rest of ``group'' holds
+// the entries of the nodes split off from it, which the caller adds to the parent.
+//
+int RTree::insert_batch(vector<Entry>& group, vector<Entry>& records, const int* idx, int len)
+{
+	RTNode* node = group[0].get_ptr();
+	if (node->level == 0) {
+		vector<bool> stored(len);
+		for (int i = 0; i < len; i++) {
+			stored[i] = find_record(node, records[idx[i]].get_mbr());
+		}
+		int inserted = 0;
+		for (int i = 0; i < len; i++) {
+			if (!stored[i]) {
+				add_entry(group, records[idx[i]]);
+				inserted++;
+			}
+		}
+		return inserted;
+	}
+
+	// route every record to its subtree, keeping the Hilbert order inside each group
+	int n = node->entry_num;
+	vector<int> child(len);
+	vector<int> start(n + 1, 0);
+	for (int i = 0; i < len; i++) {
+		const BoundingBox& mbr = records[idx[i]].get_mbr();
+		child[i] = choose_subtree(node->entries, n, mbr);
+		for (int c = 0; c < n && child[i] >= 0; c++) {
+			if (c != child[i] && node->entries[c].get_mbr().contains(mbr) && find_record(node->entries[c].get_ptr(), mbr)) {
+				child[i] = -1; // already stored
+			}
+		}
+		if (child[i] >= 0) {
+			start[child[i] + 1]++;
+		}
+	}
+	for (int c = 0; c < n; c++) {
+		start[c + 1] += start[c];
+	}
+	vector<int> routed(start[n]);
+	vector<int> pos(start.begin(), start.end() - 1);
+	for (int i = 0; i < len; i++) {
+		if (child[i] >= 0) {
+			routed[pos[child[i]]++] = idx[i];
+		}
+	}
+
+	int inserted = 0;
+	vector<Entry> new_entries;
+	for (int c = 0; c < n; c++) {
+		if (start[c] == start[c + 1]) {
+			continue;
+		}
+		vector<Entry> child_group(1, node->entries[c]);
+		inserted += insert_batch(child_group, records, &routed[start[c]], start[c + 1] - start[c]);
+		node->entries[c].set_mbr(child_group[0].get_mbr());
+		group[0].group_mbr(child_group[0].get_mbr());
+		new_entries.insert(new_entries.end(), child_group.begin() + 1, child_group.end());
+	}
+	for (int i = 0; i < new_entries.size(); i++) {
+		add_entry(group, new_entries[i]);
+	}
+	return inserted;
+}
+
+
+//
+// Replace the content of the tree by ``records'', packed bottom-up into a Hilbert-packed R-tree.
+// The records are sorted into the Hilbert order of their centers and cut into as few leaves as
+// possible, these leaves are cut the same way into the nodes of the level above, and so on up to
+// the root. Node sizes are spread evenly, so every node is nearly full. Keys must be distinct.
+//
+void RTree::bulk_load(const vector<Entry>& records)
+{
+	thaw();
+	flush_buffers();
+	summary.built = false;
+	delete root;
+	record_keys.clear();
+	int len = records.size();
+	box_records = false;
+	for (int i = 0; i < len && !box_records; i++) {
+		const BoundingBox& mbr = records[i].get_mbr();
+		box_records = mbr.get_lowest() != mbr.get_highest();
+	}
+	if (len == 0) {
+		root = create_node(0);
+		return;
+	}
+
+	vector<unsigned long long> keys(len);
+	if (engine == HILBERT_ENGINE) { // the keys of the engine, over its frame
+		for (int i = 0; i < len; i++) {
+			widen_hilbert_frame(records[i].get_mbr());
+		}
+		for (int i = 0; i < len; i++) {
+			keys[i] = hilbert_value(records[i].get_mbr().get_lowest().data(), records[i].get_mbr().get_highest().data());
+		}
+	}
+	else {
+		vector<vector<coord_t> > centers(len, vector<coord_t>(dimension));
+		for (int i = 0; i < len; i++) {
+			const BoundingBox& mbr = records[i].get_mbr();
+			for (int j = 0; j < dimension; j++) {
+				coord_t low = mbr.get_lowestValue_at(j);
+				centers[i][j] = low + (mbr.get_highestValue_at(j) - low) / 2;
+			}
+		}
+		hilbert_keys(centers, dimension, keys);
+	}
+	vector<pair<unsigned long long, int> > order(len);
+	for (int i = 0; i < len; i++) {
+		order[i] = make_pair(keys[i], i);
+	}
+	sort(order.begin(), order.end());
+
+	vector<Entry> entries(len);
+	for (int i = 0; i < len; i++) {
+		entries[i] = records[order[i].second];
+	}
+	int level = 0;
+	do {
+		int n = entries.size();
+		int capacity = level == 0 ? max_leaf_num : max_entry_num;
+		int node_num = (n + capacity - 1) / capacity;
+		vector<Entry> parents(node_num);
+		for (int k = 0, begin = 0; k < node_num; k++) {
+			int end = begin + n / node_num + (k < n % node_num ? 1 : 0);
+			RTNode* node = create_node(level);
+			for (int i = begin; i < end; i++) {
+				take_entry(node, entries[i]);
+			}
+			parents[k].set_mbr(get_mbr(node));
+			parents[k].set_ptr(node);
+			begin = end;
+		}
+		entries.swap(parents);
+		level++;
+	} while (entries.size() > 1);
+	root = entries[0].get_ptr();
+	if (engine == HILBERT_ENGINE) {
+		hilbert_sort(root);
+	}
+	if (buffer_capacity > 0) {
+		index_keys(root, true);
+	}
+}
+
+
+//
+// Move ``e'' into the node of ``group'' that needs the least enlargement, splitting that node if it is full.
+// Each entry of ``group'' holds a node and its MBR; a node split off is appended to ``group''.
+//
+void RTree::add_entry(vector<Entry>& group, Entry& e)
+{
+	int target = group.size() == 1 ? 0 : choose_subtree(&group[0], group.size(), e.get_mbr());
+	RTNode* node = group[target].get_ptr();
+	if (node->entry_num < node->size) {
+		if (node->entry_num == 0)
+			group[target].set_mbr(e.get_mbr());
+		else
+			group[target].group_mbr(e.get_mbr());
+		take_entry(node, e);
+		return;
+	}
+
+	split_node(node, e, group[target]);
+	group.push_back(Entry());
+	group.back().swap(e);
+}
+
+
+//
+// Order of split_order over split_buffer: entries preferred by tie_breaking() go last.
+//
+class SplitOrder {
+public:
+	SplitOrder(RTree* t, const Entry* buffer) : tree(t), entry_list(buffer) {}
+	bool operator()(int x, int y) const
+	{
+		return !tree->tie_breaking(entry_list[x].get_mbr(), entry_list[y].get_mbr());
+	}
+private:
+	RTree* tree;
+	const Entry* entry_list;
+};
+
+
+//
+// Put the split_buffer indices of the non-seed entries into split_order[0..len-2),
+// in the order the linear split visits them: the last one is distributed first.
+//
+void RTree::order_split_entries(int len, int m1, int m2)
+{
+	for (int i = 0; i < len; i++) {
+		split_order[i] = i;
+	}
+	// move the seeds to the end
+	swap(split_order[m2], split_order[len-1]);
+	if (m1 == len-1) {
+		m1 = m2;
+	}
+	swap(split_order[m1], split_order[len-2]);
+
+	// Entries with the same MBR make the result depend on the exact swaps of the bubble sort,
+	// so only replay it when the sort finds such a pair.
+	int remain = len-2;
+	sort(split_order, split_order + remain, SplitOrder(this, split_buffer));
+	bool same_mbr = false;
+	for (int i = 0; i+1 < remain && !same_mbr; i++) {
+		same_mbr = tie_breaking(split_buffer[split_order[i]].get_mbr(), split_buffer[split_order[i+1]].get_mbr());
+	}
+	if (!same_mbr) {
+		return;
+	}
+
+	for (int i = 0; i < len; i++) {
+		split_order[i] = i;
+	}
+	swap(split_order[m2], split_order[len-1]);
+	swap(split_order[m1], split_order[len-2]);
+	for (int i = 1; i < remain; i++) {
+		for (int j = 0; j < remain - i; j++) {
+			if (tie_breaking(split_buffer[split_order[j]].get_mbr(), split_buffer[split_order[j+1]].get_mbr())) {
+				swap(split_order[j], split_order[j+1]);
+			}
+		}
+	}
+}
+
+
+//
+// Split the full ``node'' overflowed by ``entry'' with the linear cost algorithm.
+// ``node'' keeps one group, the other group is moved to a new node. ``entry'' is moved into the
+// split and on return holds the entry of the new node for the parent, its MBR and pointer;
+// the MBR of the group ``node'' keeps is written into ``node_entry'', the entry of ``node'' in its parent.
+// Entries are moved through the per-tree split_buffer and ordered by index in split_order, and
+// the MBRs are grown in place, so nothing is copied but the leaf records, unpacked into
+// split_buffer, whose boxes keep their storage from one split to the next. The new node is a
+// spare one if there is any, see free_node().
+//
+void RTree::split_node(RTNode* node, Entry& entry, Entry& node_entry)
+{
+	for (int i = 0; i < node->entry_num; i++) {
+		if (node->level == 0)
+			node->get_record(i, split_buffer[i]);
+		else
+			split_buffer[i].swap(node->entries[i]);
+	}
+	int capacity = node->size;
+	split_buffer[capacity].swap(entry);
+
+	int m1, m2;
+	linear_pick_seeds(split_buffer, capacity+1, m1, m2);
+	order_split_entries(capacity+1, m1, m2);
+
+	RTNode* new_node = create_node(node->level);
+	const BoundingBox& old_mbr = node_entry.get_mbr();
+	const BoundingBox& new_mbr = entry.get_mbr();
+	node_entry.set_mbr(split_buffer[m1].get_mbr());
+	entry.set_mbr(split_buffer[m2].get_mbr());
+	entry.set_ptr(new_node);
+	node->entry_num = 0;
+	take_entry(node, split_buffer[m1]);
+	take_entry(new_node, split_buffer[m2]);
+
+	// split procedure
+	int remain = capacity-1;
+	int max_split_size = (capacity) / 2 + 1;
+	while (node->entry_num < max_split_size && new_node->entry_num < max_split_size) {
+		Entry& next = split_buffer[split_order[remain-1]];
+		area_t old_inc = area_inc(old_mbr, next.get_mbr());
+		area_t new_inc = area_inc(new_mbr, next.get_mbr());
+		bool add_to_old = false;
+		if (old_inc != new_inc) // less enlargement better.
+			add_to_old = old_inc < new_inc;
+		else if (area(old_mbr) != area(new_mbr)) // smaller area better.
+			add_to_old = area(old_mbr) < area(new_mbr);
+		else if (node->entry_num != new_node->entry_num) // fewer entries num better.
+			add_to_old = node->entry_num < new_node->entry_num;
+		else 
+			add_to_old = tie_breaking(old_mbr, new_mbr);
+
+		if (add_to_old) {
+			node_entry.group_mbr(next.get_mbr());
+			take_entry(node, next);
+		}
+		else {
+			entry.group_mbr(next.get_mbr());
+			take_entry(new_node, next);
+		}
+		remain--;
+	}
+	
+	// one node reaches max num nodes, assign the remaining to the other node
+	RTNode* rest = (node->entry_num == max_split_size) ? new_node : node;
+	Entry& rest_entry = (node->entry_num == max_split_size) ? entry : node_entry;
+	for (int i = remain-1; i >= 0; i--) {
+		Entry& next = split_buffer[split_order[i]];
+		rest_entry.group_mbr(next.get_mbr());
+		take_entry(rest, next);
+	}
+
+	// the buffer stays with ``node'', and either part may have records buffered below it
+	for (int i = 0; i < node->buffer.size(); i++)
+		node_entry.group_mbr(node->buffer[i].get_mbr());
+	new_node->buffered_below = node->buffered_below;
+}
+
+
+//
+// Reinsert ``len'' entries at ``dest_level'' in the given order.
+// The entries come from the tree itself, so the duplicate check is skipped and
+// the path buffers are shared by the whole batch.
+//
+void RTree::reinsert(const Entry* entry_list, int len, int dest_level)
+{
+	int capacity = root->level + 1;
+	RTNode** stack = new RTNode*[capacity];
+	int* entry_idx = new int[capacity];
+	for (int i = 0; i < len; i++) {
+		if (root->level >= capacity) { // the root has been split by the previous entry
+			delete []stack;
+			delete []entry_idx;
+			capacity = root->level + 1;
+			stack = new RTNode*[capacity];
+			entry_idx = new int[capacity];
+		}
+		insert(entry_list[i], dest_level, stack, entry_idx);
+	}
+	delete []stack;
+	delete []entry_idx;
+}
+
+static bool compare_node(RTNode *x, RTNode *y)
+{
+    return x->level > y->level;
+}
+
+//
+// Order entries by tie_breaking() of their MBRs, without constructing a tree per comparison.
+//
+class EntryOrder {
+public:
+	EntryOrder(RTree* t) : tree(t) {}
+	bool operator()(const Entry& x, const Entry& y) const
+	{
+		return tree->tie_breaking(x.get_mbr(), y.get_mbr());
+	}
+private:
+	RTree* tree;
+};
+
+void RTree::condense_tree(RTNode* L, RTNode** stack, int* entry_idx, int stack_size)
+{
+    RTNode* N=L;
+    
+    vector<RTNode*> Q;  //the set of eliminated nodes, initially empty
+    while (N!=this->root){
+        int EN=entry_idx[stack_size];
+        RTNode* P=stack[stack_size];
+        
+        if (N->entry_num<ceil(0.5*N->size)){  //if N has fewer than m entries
+            
+            detach_entry(P, EN);
+            Q.push_back(N);
+        }
+        else{  //if N has not been eliminated, adjust EnI to tightly contain all entries in N
+            BoundingBox new_box(get_mbr(N));
+            P->entries[EN].set_mbr(new_box);
+        }
+        N=P; //set N=P and repeat
+        stack_size--;
+    }
+    reinsert_orphans(Q);
+}
+
+//
+// Reinsert the entries of the nodes eliminated by a deletion at their own levels, then free the nodes.
+// Records buffered in the eliminated subtrees are given back through the root, see rebuffer().
+//
+void RTree::reinsert_orphans(vector<RTNode*>& Q)
+{
+    vector<Entry> buffered;
+    sort(Q.begin(), Q.end(), compare_node); //higher level nodes first
+    for (int i = 0; i < Q.size(); i++)
+    {
+      if (buffered_num > 0)
+        take_buffers(Q.at(i), buffered);
+      Entry* orphans = Q.at(i)->entries;
+      vector<Entry> records;
+      if (Q.at(i)->level == 0) { //leaf records are packed, reinsert them as entries
+        records.resize(Q.at(i)->entry_num);
+        for (int j = 0; j < Q.at(i)->entry_num; j++)
+          Q.at(i)->get_record(j, records[j]);
+        orphans = records.empty() ? NULL : &records[0];
+      }
+      sort(orphans, orphans + Q.at(i)->entry_num, EntryOrder(this)); //tie_breaking between entries
+      reinsert(orphans, Q.at(i)->entry_num, Q.at(i)->level); //higher entries must be placed higher
+      Q.at(i)->entry_num = 0; // its children now belong to the tree
+      free_node(Q.at(i));
+    }
+    rebuffer(buffered);
+}
+
+//
+// Replace a non-leaf root having a single child by that child, which takes over its buffer.
+// Return false if the root stays.
+//
+bool RTree::shrink_root()
+{
+    if (root->level == 0 || root->entry_num != 1)
+        return false;
+    RTNode* old_root = root;
+    root = root->entries[0].get_ptr();
+    vector<Entry> buffered;
+    buffered.swap(old_root->buffer);
+    old_root->entry_num = 0; // keep its only child
+    free_node(old_root);
+    rebuffer(buffered);
+    return true;
+}
+
+bool RTree::del(const vector<coord_t>& coordinate)
+{
+    BoundingBox B(coordinate,coordinate);
+    return del(B);
+}
+
+
+//
+// Delete the record whose MBR is exactly ``B''.
+//
+bool RTree::del(const BoundingBox& B)
+{
+	if (B.get_dim() != this->dimension)
+	{
+		cerr << "R-tree dimensionality inconsistency\n";
+	}
+	thaw();
+    RTNode* stack[20];
+    int entry_idx[20];
+    int stack_size=1;
+    
+    if (buffered_num > 0) { // the record may still wait in a buffer on its way down
+        Entry record;
+        if (erase_buffered(root, B, record)) {
+            record_keys.erase(record_key(B));
+            summary.changes++;
+            return true;
+        }
+    }
+    Entry E(B,1);
+    RTNode* L=find_leaf(this->root, stack, entry_idx, stack_size, E); //Find the leaf node and delete the ``record''.
+    
+//    
+//    RTNode* L=this->root->find_leaf(coordinate,index); //T could be the found leaf or NULL
+    stack_size--;
+    if (L==NULL) {
+      // cout<<"Deleting ";
+      //  B.print();
+      //  cout<<" but failed find_leaf()\n";
+        return false; //if there is no such entry
+        
+    }
+    else{ //swap E with the last entry of L(if needed), then remove the last entry of L from L
+
+        condense_tree(L,stack,entry_idx, stack_size); //Invoke CondenseTree, passing L
+        if (buffer_capacity > 0)
+            record_keys.erase(record_key(B));
+        shrink_root(); //D4
+    }
+    summary.changes++;
+    return true;
+    
+    
+}
+
+//
+// Move the point record at ``old_coord'' to ``new_coord'', keeping its record id.
+// A point that stays within the MBR of its leaf, enlarged by ``tolerance'' times the MBR extent
+// on each side, is rewritten in place and only the MBRs above the leaf are refitted;
+// a point moving further is deleted and reinserted. The Hilbert engine always reinserts, since
+// the new position changes the place of the record in Hilbert order.
+// Return false if there is no record at ``old_coord'' or another one already at ``new_coord''.
+//
+bool RTree::update(const vector<coord_t>& old_coord, const vector<coord_t>& new_coord, double tolerance)
+{
+	if (old_coord.size() != this->dimension || new_coord.size() != this->dimension)
+	{
+		cerr << "R-tree dimensionality inconsistency\n";
+	}
+	thaw();
+	BoundingBox old_mbr(old_coord, old_coord);
+	BoundingBox new_mbr(new_coord, new_coord);
+	if (old_mbr.is_equal(new_mbr))
+		return has_record(old_mbr);
+	if (buffer_capacity > 0) { // the keys of all the records are at hand, buffered ones included
+		if (has_record(new_mbr))
+			return false; // keys are unique, as for insert()
+		Entry record; // a buffered record has no leaf to stay in: it is buffered again
+		if (buffered_num > 0 && erase_buffered(root, old_mbr, record)) {
+			record_keys.erase(record_key(old_mbr));
+			return insert(new_coord, record.get_rid());
+		}
+	}
+
+	// otherwise the leaf of the record is found and the new key checked in one traversal
+	vector<RTNode*> stack(root->level + 1);
+	vector<int> entry_idx(root->level + 1);
+	int stack_size = 1;
+	int slot = 0;
+	bool taken = false;
+	RTNode* L = find_leaf(this->root, &stack[0], &entry_idx[0], stack_size, old_mbr, buffer_capacity > 0 ? NULL : &new_mbr, slot, taken);
+	stack_size--;
+	if (L == NULL)
+		return false;
+	detach_entry(L, slot); // the record is moved past the end of L
+
+	int rid = L->get_rid(L->entry_num);
+	if (buffer_capacity > 0) {
+		record_keys.erase(record_key(old_mbr));
+	}
+	bool in_place = engine == GUTTMAN_ENGINE;
+	if (stack_size > 0 && in_place) {
+		const BoundingBox& leaf_mbr = stack[stack_size]->entries[entry_idx[stack_size]].get_mbr();
+		for (int j = 0; j < this->dimension && in_place; j++) {
+			double low = leaf_mbr.get_lowestValue_at(j);
+			double high = leaf_mbr.get_highestValue_at(j);
+			double slack = (high - low) * tolerance;
+			in_place = low - slack <= new_coord[j] && new_coord[j] <= high + slack;
+		}
+	}
+	if (in_place) {
+		L->set_record(L->entry_num, &new_coord[0], &new_coord[0], rid);
+		L->entry_num++;
+		if (buffer_capacity > 0) {
+			record_keys.insert(record_key(new_mbr));
+		}
+		refit_path(&stack[0], &entry_idx[0], stack_size);
+		summary.changes++;
+		return true;
+	}
+
+	// too far from its leaf: finish the deletion as del() does, then reinsert
+	condense_tree(L, &stack[0], &entry_idx[0], stack_size);
+	shrink_root();
+	return insert(new_coord, rid);
+}
+
+//
+// Refit the MBRs on the path to a leaf whose records changed, bottom-up.
+// Stop at the first ancestor entry whose MBR is unchanged since nothing above it changes.
+//
+void RTree::refit_path(RTNode** stack, int* entry_idx, int size)
+{
+	while (size > 0) {
+		Entry& parent_entry = stack[size]->entries[entry_idx[size]];
+		BoundingBox mbr(get_mbr(parent_entry.get_ptr()));
+		if (parent_entry.get_mbr().is_equal(mbr))
+			return;
+		parent_entry.set_mbr(mbr);
+		size--;
+	}
+}
+
+//
+// Delete every record matching ``mbr'' under ``pred'' (see query_range()) in a single traversal.
+// Subtrees lying inside ``mbr'' are detached as a whole, and the underfull nodes left behind
+// are eliminated and their entries reinserted once at the end, as condense_tree() does.
+// Return the number of records deleted.
+//
+int RTree::del_range(const BoundingBox& mbr, RangePredicate pred)
+{
+	if (mbr.get_dim() != this->dimension)
+	{
+		cerr << "R-tree dimensionality inconsistency\n";
+	}
+	thaw();
+	vector<RTNode*> orphans;
+	int deleted = del_range(root, mbr, pred, orphans);
+	summary.changes += deleted;
+	vector<Entry> buffered;
+	if (root->level != 0 && root->entry_num == 0) {
+		// nothing is left below the root: the highest eliminated node, if any, takes its place
+		buffered.swap(root->buffer);
+		free_node(root);
+		if (orphans.empty()) {
+			root = create_node(0);
+		}
+		else {
+			sort(orphans.begin(), orphans.end(), compare_node);
+			root = orphans[0];
+			orphans.erase(orphans.begin());
+		}
+	}
+	reinsert_orphans(orphans);
+	rebuffer(buffered);
+	while (shrink_root())
+		;
+	return deleted;
+}
+
+//
+// Helper function of del_range(): delete the matching records below ``node'', buffered ones included.
+// Children left empty are freed, their remaining buffered records moving up into the buffer
+// of ``node'', and underfull ones are detached into ``orphans''.
+//
+int RTree::del_range(RTNode* node, const BoundingBox& mbr, RangePredicate pred, vector<RTNode*>& orphans)
+{
+	int deleted = 0;
+	for (int k = (int)node->buffer.size() - 1; k >= 0; k--) {
+		const BoundingBox& record_mbr = node->buffer[k].get_mbr();
+		if (pred == CONTAINED_IN ? mbr.contains(record_mbr) : overlap(record_mbr, mbr)) {
+			record_keys.erase(record_key(record_mbr));
+			node->buffer[k].swap(node->buffer.back());
+			node->buffer.pop_back();
+			buffered_num--;
+			deleted++;
+		}
+	}
+	if (node->level == 0) {
+		for (int i = node->entry_num - 1; i >= 0; i--) {
+			bool match = (pred == CONTAINED_IN && node->boxes)
+				? mbr.contains(node->get_point(i), node->get_high(i))
+				: record_overlap(node, i, mbr);
+			if (match) {
+				if (buffer_capacity > 0)
+					record_keys.erase(record_key(node->get_point(i), node->get_high(i), dimension));
+				detach_entry(node, i);
+				deleted++;
+			}
+		}
+		return deleted;
+	}
+	for (int i = node->entry_num - 1; i >= 0; i--) {
+		if (!overlap(node->entries[i].get_mbr(), mbr))
+			continue;
+		RTNode* child = node->entries[i].get_ptr();
+		if (mbr.contains(node->entries[i].get_mbr())) {
+			// every record below matches under either predicate: drop the whole subtree
+			int record_cnt = 0, node_cnt = 0;
+			stat(child, record_cnt, node_cnt);
+			deleted += record_cnt;
+			if (buffer_capacity > 0)
+				index_keys(child, false);
+			if (buffered_num > 0) {
+				vector<Entry> dropped;
+				take_buffers(child, dropped);
+				deleted += dropped.size();
+				buffered_num -= dropped.size();
+			}
+			free_node(child);
+		}
+		else {
+			int child_deleted = del_range(child, mbr, pred, orphans);
+			deleted += child_deleted;
+			if (child->entry_num >= ceil(0.5 * child->size)) {
+				if (child_deleted > 0)
+					node->entries[i].set_mbr(get_mbr(child));
+				continue;
+			}
+			if (child->entry_num == 0) {
+				for (int k = 0; k < child->buffer.size(); k++) {
+					node->buffer.push_back(Entry());
+					node->buffer.back().swap(child->buffer[k]);
+				}
+				free_node(child);
+			}
+			else
+				orphans.push_back(child); // underfull, its entries are reinserted by the caller
+		}
+		detach_entry(node, i);
+	}
+	return deleted;
+}
+
+//
+// Helper function for the query_range() that reports the records: append those of ``node''
+// that match ``mbr'' under ``pred'' to ``results''.
+//
+void RTree::query_range(const RTNode* node, const BoundingBox& mbr, RangePredicate pred, vector<Entry>& results)
+{
+	if (node->level == 0) {
+		for (int i = 0; i < node->entry_num; i++) {
+			bool match = (pred == CONTAINED_IN && node->boxes)
+				? mbr.contains(node->get_point(i), node->get_high(i))
+				: record_overlap(node, i, mbr);
+			if (match) {
+				results.push_back(Entry());
+				node->get_record(i, results.back());
+			}
+		}
+		return;
+	}
+	for (int i = 0; i < node->entry_num; i++) {
+		if (overlap(node->entries[i].get_mbr(), mbr)) {
+			query_range(node->entries[i].get_ptr(), mbr, pred, results);
+		}
+	}
+}
+
+
+//
+// Range query that reports the records: append those matching ``mbr'' under ``pred'' to ``results''.
+// A frozen tree is thawed first.
+//
+void RTree::query_range(const BoundingBox& mbr, vector<Entry>& results, RangePredicate pred)
+{
+	thaw();
+	flush_buffers();
+	query_range(root, mbr, pred, results);
+}
+
+
+//
+// Append every record of the tree to ``records''.
+//
+void RTree::get_records(vector<Entry>& records)
+{
+	thaw();
+	flush_buffers();
+	if (root->entry_num > 0) {
+		query_range(root, get_mbr(root), INTERSECTS, records);
+	}
+}
+
+
+
+void RTree::query_range(const BoundingBox& mbr, int& result_count, int& node_travelled, RangePredicate pred)
+{
+	
+	result_count = 0;
+	node_travelled = 0;
+	if (frozen != NULL) {
+		query_range_frozen(mbr, pred, result_count, node_travelled, query_scratch);
+		return;
+	}
+#ifdef RTREE_RECURSIVE_QUERY
+	query_range(root, mbr, pred, result_count, node_travelled);
+#else
+	query_range_iterative(mbr, pred, result_count, node_travelled, query_scratch);
+#endif
+}
+
+
+bool RTree::query_point(const vector<coord_t>& coordinate, Entry& result)
+{
+	BoundingBox mbr(coordinate, coordinate);
+	if (frozen != NULL)
+		return query_point_frozen(mbr, result, query_scratch);
+#ifdef RTREE_RECURSIVE_QUERY
+	return query_point(root, mbr, result);
+#else
+	return query_point_iterative(mbr, result, query_scratch);
+#endif
+}
+
+
+
+//
+// A frozen leaf slot holds a FrozenHeader, the records packed as in RTNode::coords, then the
+// record ids from byte frozen_leaf_ids on. An internal slot holds a FrozenHeader, the corners of
+// the entry MBRs (lowest then highest, 2 * dim coordinates each), then from byte frozen_inner_ids
+// on the cache line index of each child slot. With quantized MBRs (frozen_bits != 0) the corners
+// are replaced by the exact MBR of the node followed by the entry corners in frozen_bits bits each,
+// relative to that MBR.
+//
+struct FrozenHeader {
+	int level;
+	int entry_num;
+};
+
+static inline const coord_t* frozen_coords(const char* slot)
+{
+	return (const coord_t*)(slot + sizeof(FrozenHeader));
+}
+
+// The k-th quantized corner coordinate of an internal slot.
+static inline int frozen_quantized(const char* slot, int dim, int bits, int k)
+{
+	const char* quantized = slot + sizeof(FrozenHeader) + 2 * dim * sizeof(coord_t);
+	return bits == 8 ? ((const unsigned char*)quantized)[k] : ((const unsigned short*)quantized)[k];
+}
+
+// Position of ``value'' on dimension ``j'' in the quantized frame [0, 2^bits - 1] of a node with the
+// MBR corners ``low'' and ``high''. It is monotone in ``value'', so rounding corners outward and the
+// query range inward keeps every overlap.
+static inline double frozen_scaled(coord_t value, const coord_t* low, const coord_t* high, int j, int bits)
+{
+	double extent = (double)high[j] - (double)low[j];
+	if (extent <= 0)
+		return 0;
+	return ((double)value - (double)low[j]) * (((1 << bits) - 1) / extent);
+}
+
+static inline int frozen_clamp(double q, int bits)
+{
+	return q < 0 ? 0 : q > (1 << bits) - 1 ? (1 << bits) - 1 : (int)q;
+}
+
+// The window of ``mbr'' in the quantized frame of the internal ``slot'': 2 * dim bounds, the range
+// rounded inward on each dimension.
+static inline void frozen_window(const char* slot, const BoundingBox& mbr, int dim, int bits, int* window)
+{
+	const coord_t* low = frozen_coords(slot);
+	const coord_t* high = low + dim;
+	for (int k = 0; k < dim; k++) {
+		window[2 * k] = frozen_clamp(ceil(frozen_scaled(mbr.get_lowestValue_at(k), low, high, k, bits)), bits);
+		window[2 * k + 1] = frozen_clamp(floor(frozen_scaled(mbr.get_highestValue_at(k), low, high, k, bits)), bits);
+	}
+}
+
+// Whether the quantized MBR of entry ``i'' of the internal ``slot'' overlaps ``window''.
+static inline bool frozen_overlap(const char* slot, int i, const int* window, int dim, int bits)
+{
+	for (int k = 0; k < dim; k++) {
+		if (frozen_quantized(slot, dim, bits, 2 * i * dim + k) > window[2 * k + 1]
+			|| frozen_quantized(slot, dim, bits, (2 * i + 1) * dim + k) < window[2 * k])
+			return false;
+	}
+	return true;
+}
+
+// The corners of the MBR of entry ``i'' of the internal ``slot'' (lowest then highest), a quantized
+// MBR mapped back and rounded outward, so the result covers the MBR of the entry.
+static inline void frozen_corners(const char* slot, int i, int dim, int bits, coord_t* corners)
+{
+	const coord_t* coords = frozen_coords(slot);
+	for (int k = 0; k < 2 * dim; k++) {
+		if (bits == 0) {
+			corners[k] = coords[2 * i * dim + k];
+			continue;
+		}
+		int d = k % dim;
+		double extent = (double)coords[dim + d] - (double)coords[d];
+		double q = frozen_quantized(slot, dim, bits, 2 * i * dim + k);
+		double value = (double)coords[d] + (extent > 0 ? q * extent / ((1 << bits) - 1) : 0);
+		if (numeric_limits<coord_t>::is_integer) {
+			corners[k] = (coord_t)(k < dim ? floor(value) : ceil(value));
+			continue;
+		}
+		// the mapping is off by a few roundings at most
+		double slack = 8 * numeric_limits<double>::epsilon() * (fabs((double)coords[d]) + extent);
+		corners[k] = (coord_t)(k < dim ? value - slack : value + slack);
+		corners[k] = nextafter(corners[k], k < dim ? -numeric_limits<coord_t>::max() : numeric_limits<coord_t>::max());
+	}
+}
+
+
+//
+// Append the nodes of the top ``levels'' levels of the subtree at ``node'' in van Emde Boas order:
+// the top half of the levels first, then each subtree hanging below it, all laid out recursively.
+//
+static void veb_order(RTNode* node, int levels, vector<RTNode*>& order)
+{
+	if (levels == 1) {
+		order.push_back(node);
+		return;
+	}
+	int top = levels / 2;
+	veb_order(node, top, order);
+	vector<RTNode*> bottom(1, node);
+	for (int l = 0; l < top; l++) {
+		vector<RTNode*> below;
+		for (int i = 0; i < bottom.size(); i++) {
+			for (int j = 0; j < bottom[i]->entry_num; j++)
+				below.push_back(bottom[i]->entries[j].get_ptr());
+		}
+		bottom.swap(below);
+	}
+	for (int i = 0; i < bottom.size(); i++)
+		veb_order(bottom[i], levels - top, order);
+}
+
+
+//
+// Append the leaves below ``node'' to ``leaves'', left to right, and delete the internal nodes above them.
+//
+static void detach_leaves(RTNode* node, vector<RTNode*>& leaves)
+{
+	if (node->level == 0) {
+		leaves.push_back(node);
+		return;
+	}
+	for (int i = 0; i < node->entry_num; i++)
+		detach_leaves(node->entries[i].get_ptr(), leaves);
+	node->entry_num = 0;
+	delete node;
+}
+
+
+//
+// Sort ``nodes'' into the Hilbert order of the centers of their MBRs, as bulk_load() sorts records.
+//
+void RTree::hilbert_sort_nodes(vector<RTNode*>& nodes)
+{
+	vector<vector<coord_t> > centers(nodes.size(), vector<coord_t>(dimension));
+	for (int i = 0; i < nodes.size(); i++) {
+		BoundingBox mbr = get_mbr(nodes[i]);
+		for (int j = 0; j < dimension; j++) {
+			coord_t low = mbr.get_lowestValue_at(j);
+			centers[i][j] = low + (mbr.get_highestValue_at(j) - low) / 2;
+		}
+	}
+	vector<unsigned long long> keys(nodes.size());
+	hilbert_keys(centers, dimension, keys);
+	vector<pair<unsigned long long, RTNode*> > order(nodes.size());
+	for (int i = 0; i < nodes.size(); i++)
+		order[i] = make_pair(keys[i], nodes[i]);
+	sort(order.begin(), order.end());
+	for (int i = 0; i < nodes.size(); i++)
+		nodes[i] = order[i].second;
+}
+
+
+//
+// Build the internal levels over ``nodes'', a level of the tree left to right, grouping runs of
+// consecutive nodes into parents of at most ``fanout'' children, as evenly as possible so every
+// parent holds more than half of ``fanout'' if there are several. Return the root.
+//
+RTNode* RTree::pack_levels(vector<RTNode*>& nodes, int fanout)
+{
+	while (nodes.size() > 1) {
+		int groups = (nodes.size() + fanout - 1) / fanout;
+		vector<RTNode*> parents;
+		for (int g = 0, i = 0; g < groups; g++) {
+			int len = (nodes.size() - i) / (groups - g);
+			RTNode* parent = new RTNode(nodes[i]->level + 1, fanout, dimension, box_records);
+			parent->page = next_page++;
+			for (int j = 0; j < len; j++) {
+				parent->entries[j].set_ptr(nodes[i + j]);
+				parent->entries[j].set_mbr(get_mbr(nodes[i + j]));
+			}
+			parent->entry_num = len;
+			parents.push_back(parent);
+			i += len;
+		}
+		nodes.swap(parents);
+	}
+	return nodes[0];
+}
+
+
+//
+// Allocate the array of a frozen tree, on huge pages if it spans one.
+//
+static char* alloc_frozen(size_t bytes)
+{
+	size_t align = bytes >= HUGE_PAGE ? HUGE_PAGE : CACHE_LINE;
+	void* array = NULL;
+	if (posix_memalign(&array, align, bytes) != 0)
+		throw bad_alloc();
+#ifdef MADV_HUGEPAGE
+	if (align == HUGE_PAGE)
+		madvise(array, bytes, MADV_HUGEPAGE);
+#endif
+	return (char*)array;
+}
+
+
+//
+// Relay the tree into one contiguous array of node slots, in the order ``layout'', with the cache
+// line index of the child slots in place of the child pointers, and release the RTNodes.
+// With ``quantize_bits'' (8 or 16) the child MBRs of internal slots are stored quantized, and the
+// internal levels are rebuilt over the leaves with as many children per node as fit in the cache
+// lines of an exact slot, which makes the tree wider and lower; the queries stay exact as leaves
+// keep the records.
+// Slots start on cache lines; an array of a huge page or more is aligned on, and advised into,
+// huge pages. Queries run on the frozen tree, any other operation thaws it first (see thaw()).
+//
+void RTree::freeze(FrozenLayout layout, int quantize_bits)
+{
+	if (quantize_bits != 0 && quantize_bits != 8 && quantize_bits != 16) {
+		cerr << "Quantized MBRs take 8 or 16 bits\n";
+		return;
+	}
+	thaw();
+	flush_buffers();
+	int width = box_records ? 2 * dimension : dimension;
+	frozen_bits = quantize_bits;
+	frozen_fanout = max_entry_num;
+	frozen_leaf_ids = sizeof(FrozenHeader) + max_leaf_num * width * sizeof(coord_t);
+	frozen_inner_ids = sizeof(FrozenHeader) + max_entry_num * 2 * dimension * sizeof(coord_t);
+	size_t leaf_lines = (frozen_leaf_ids + max_leaf_num * sizeof(int) + CACHE_LINE - 1) / CACHE_LINE;
+	size_t inner_lines = (frozen_inner_ids + max_entry_num * sizeof(int) + CACHE_LINE - 1) / CACHE_LINE;
+	if (quantize_bits != 0) { // the most quantized entries that fit in the lines of an exact slot
+		size_t quantized;
+		for (int fanout = max_entry_num; ; fanout++) {
+			quantized = (fanout * 2 * dimension * quantize_bits / 8 + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+			if (sizeof(FrozenHeader) + 2 * dimension * sizeof(coord_t) + quantized + fanout * sizeof(int) > inner_lines * CACHE_LINE)
+				break;
+			frozen_fanout = fanout;
+		}
+		quantized = (frozen_fanout * 2 * dimension * quantize_bits / 8 + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+		frozen_inner_ids = sizeof(FrozenHeader) + 2 * dimension * sizeof(coord_t) + quantized;
+		inner_lines = (frozen_inner_ids + frozen_fanout * sizeof(int) + CACHE_LINE - 1) / CACHE_LINE;
+		if (root->level != 0 && frozen_fanout > max_entry_num) {
+			vector<RTNode*> leaves;
+			detach_leaves(root, leaves);
+			if (engine != HILBERT_ENGINE) // its leaves are in Hilbert order already
+				hilbert_sort_nodes(leaves);
+			root = pack_levels(leaves, frozen_fanout);
+		}
+	}
+
+	vector<RTNode*> order;
+	if (layout == VAN_EMDE_BOAS) {
+		veb_order(root, root->level + 1, order);
+	} else {
+		order.push_back(root);
+		for (int i = 0; i < order.size(); i++) {
+			if (order[i]->level != 0) {
+				for (int j = 0; j < order[i]->entry_num; j++)
+					order.push_back(order[i]->entries[j].get_ptr());
+			}
+		}
+	}
+	map<const RTNode*, int> line_of;
+	size_t lines = 0;
+	for (int i = 0; i < order.size(); i++) {
+		line_of[order[i]] = lines;
+		lines += order[i]->level == 0 ? leaf_lines : inner_lines;
+	}
+
+	frozen_bytes = lines * CACHE_LINE;
+	frozen = alloc_frozen(frozen_bytes);
+
+	for (int i = 0; i < order.size(); i++) {
+		const RTNode* node = order[i];
+		char* slot = frozen + (size_t)line_of[node] * CACHE_LINE;
+		FrozenHeader* header = (FrozenHeader*)slot;
+		coord_t* coords = (coord_t*)frozen_coords(slot);
+		header->level = node->level;
+		header->entry_num = node->entry_num;
+		if (node->level == 0) {
+			memcpy(coords, node->coords, node->entry_num * width * sizeof(coord_t));
+			memcpy(slot + frozen_leaf_ids, node->rids, node->entry_num * sizeof(int));
+			continue;
+		}
+		int* ids = (int*)(slot + frozen_inner_ids);
+		if (quantize_bits == 0) {
+			for (int j = 0; j < node->entry_num; j++) {
+				const BoundingBox& mbr = node->entries[j].get_mbr();
+				for (int k = 0; k < dimension; k++) {
+					coords[2 * j * dimension + k] = mbr.get_lowestValue_at(k);
+					coords[(2 * j + 1) * dimension + k] = mbr.get_highestValue_at(k);
+				}
+				ids[j] = line_of[node->entries[j].get_ptr()];
+			}
+			continue;
+		}
+		BoundingBox node_mbr = get_mbr(node);
+		const coord_t* low = coords;
+		const coord_t* high = coords + dimension;
+		for (int k = 0; k < dimension; k++) {
+			coords[k] = node_mbr.get_lowestValue_at(k);
+			coords[dimension + k] = node_mbr.get_highestValue_at(k);
+		}
+		void* quantized = slot + sizeof(FrozenHeader) + 2 * dimension * sizeof(coord_t);
+		for (int j = 0; j < node->entry_num; j++) {
+			const BoundingBox& mbr = node->entries[j].get_mbr();
+			for (int k = 0; k < dimension; k++) {
+				int q_low = frozen_clamp(floor(frozen_scaled(mbr.get_lowestValue_at(k), low, high, k, quantize_bits)), quantize_bits);
+				int q_high = frozen_clamp(ceil(frozen_scaled(mbr.get_highestValue_at(k), low, high, k, quantize_bits)), quantize_bits);
+				if (quantize_bits == 8) {
+					((unsigned char*)quantized)[2 * j * dimension + k] = q_low;
+					((unsigned char*)quantized)[(2 * j + 1) * dimension + k] = q_high;
+				} else {
+					((unsigned short*)quantized)[2 * j * dimension + k] = q_low;
+					((unsigned short*)quantized)[(2 * j + 1) * dimension + k] = q_high;
+				}
+			}
+			ids[j] = line_of[node->entries[j].get_ptr()];
+		}
+	}
+	delete root;
+	root = NULL;
+	if (page_buffer != NULL)
+		page_buffer->clear(); // the slots are new pages
+}
+
+
+//
+// A frozen copy of this frozen tree, or NULL if it is not frozen. The calling thread copies the
+// array, so under the default first-touch policy its pages come from the memory of the NUMA node
+// that thread runs on, see ReplicatedRTree.
+//
+RTree* RTree::replicate() const
+{
+	if (frozen == NULL)
+		return NULL;
+	RTree* copy = new RTree(max_leaf_num, max_entry_num, dimension, engine);
+	delete copy->root;
+	copy->root = NULL;
+	copy->box_records = box_records;
+	copy->hilbert_bits = hilbert_bits;
+	copy->frozen_bits = frozen_bits;
+	copy->frozen_fanout = frozen_fanout;
+	copy->frozen_leaf_ids = frozen_leaf_ids;
+	copy->frozen_inner_ids = frozen_inner_ids;
+	copy->frozen_bytes = frozen_bytes;
+	copy->frozen = alloc_frozen(frozen_bytes);
+	memcpy(copy->frozen, frozen, frozen_bytes);
+	return copy;
+}
+
+
+//
+// Rebuild the RTNodes of a frozen tree and release its array. Does nothing if it is not frozen.
+// The largest Hilbert values of the nodes are not frozen, the Hilbert engine recomputes them.
+//
+void RTree::thaw()
+{
+	if (frozen == NULL)
+		return;
+	if (frozen_fanout > max_entry_num) { // repacked by freeze(): pack the leaves back at max_entry_num
+		vector<RTNode*> leaves;
+		thaw_leaves(0, leaves);
+		root = pack_levels(leaves, max_entry_num);
+	} else {
+		root = thaw_node(0);
+	}
+	free(frozen);
+	frozen = NULL;
+	if (page_buffer != NULL)
+		page_buffer->clear();
+	if (engine == HILBERT_ENGINE)
+		hilbert_sort(root);
+}
+
+
+bool RTree::is_frozen() const
+{
+	return frozen != NULL;
+}
+
+
+// Helper function for thaw(). Rebuild the leaves below the slot at cache line ``line'' into
+// ``leaves'', left to right.
+void RTree::thaw_leaves(int line, vector<RTNode*>& leaves)
+{
+	const char* slot = frozen + (size_t)line * CACHE_LINE;
+	const FrozenHeader* header = (const FrozenHeader*)slot;
+	if (header->level == 0) {
+		leaves.push_back(thaw_node(line));
+		return;
+	}
+	const int* ids = (const int*)(slot + frozen_inner_ids);
+	for (int j = 0; j < header->entry_num; j++)
+		thaw_leaves(ids[j], leaves);
+}
+
+
+// Helper function for thaw(). Rebuild the subtree of the slot at cache line ``line''.
+// Quantized child MBRs are recomputed from the rebuilt children.
+RTNode* RTree::thaw_node(int line)
+{
+	const char* slot = frozen + (size_t)line * CACHE_LINE;
+	const FrozenHeader* header = (const FrozenHeader*)slot;
+	const coord_t* coords = frozen_coords(slot);
+	RTNode* node = create_node(header->level);
+	if (node->level == 0) {
+		const int* ids = (const int*)(slot + frozen_leaf_ids);
+		int width = box_records ? 2 * dimension : dimension;
+		for (int j = 0; j < header->entry_num; j++) {
+			const coord_t* low = coords + j * width;
+			node->set_record(j, low, low + width - dimension, ids[j]);
+		}
+	} else {
+		const int* ids = (const int*)(slot + frozen_inner_ids);
+		for (int j = 0; j < header->entry_num; j++) {
+			RTNode* child = thaw_node(ids[j]);
+			node->entries[j].set_ptr(child);
+			if (frozen_bits == 0) {
+				const coord_t* low = coords + 2 * j * dimension;
+				node->entries[j].set_mbr(BoundingBox(vector<coord_t>(low, low + dimension), vector<coord_t>(low + dimension, low + 2 * dimension)));
+			} else {
+				node->entries[j].set_mbr(get_mbr(child));
+			}
+		}
+	}
+	node->entry_num = header->entry_num;
+	return node;
+}
+
+
+//
+// Helper function for the frozen queries. Push the children of the internal ``slot'' whose MBR
+// overlaps ``mbr'' onto the stack of ``scratch'', last entry first, prefetching their slots.
+// Quantized MBRs are tested in the quantized frame of the node, where rounding may only let
+// extra children through.
+//
+void RTree::push_frozen_children(const char* slot, const BoundingBox& mbr, QueryScratch& scratch) const
+{
+	const FrozenHeader* header = (const FrozenHeader*)slot;
+	const coord_t* coords = frozen_coords(slot);
+	const int* ids = (const int*)(slot + frozen_inner_ids);
+	if (frozen_bits == 0) {
+		for (int i = header->entry_num - 1; i >= 0; i--) {
+			const coord_t* low = coords + 2 * i * dimension;
+			if (mbr.is_intersected(low, low + dimension)) {
+				prefetch(frozen + (size_t)ids[i] * CACHE_LINE);
+				scratch.stack.push_back(ids[i]);
+			}
+		}
+		return;
+	}
+
+	scratch.window.resize(2 * dimension);
+	int* window = &scratch.window[0];
+	frozen_window(slot, mbr, dimension, frozen_bits, window);
+	for (int i = header->entry_num - 1; i >= 0; i--) {
+		if (frozen_overlap(slot, i, window, dimension, frozen_bits)) {
+			prefetch(frozen + (size_t)ids[i] * CACHE_LINE);
+			scratch.stack.push_back(ids[i]);
+		}
+	}
+}
+
+
+//
+// query_range() on the frozen tree, in the same order as query_range_iterative().
+//
+void RTree::query_range_frozen(const BoundingBox& mbr, RangePredicate pred, int& result_cnt, int& node_traveled, QueryScratch& scratch) const
+{
+	vector<int>& stack = scratch.stack;
+	stack.clear();
+	stack.push_back(0);
+	while (!stack.empty()) {
+		const char* slot = frozen + (size_t)stack.back() * CACHE_LINE;
+		read_page(scratch.pages, stack.back());
+		stack.pop_back();
+		const FrozenHeader* header = (const FrozenHeader*)slot;
+		node_traveled++;
+		if (header->level != 0) {
+			push_frozen_children(slot, mbr, scratch);
+			continue;
+		}
+		const coord_t* coords = frozen_coords(slot);
+		int width = box_records ? 2 * dimension : dimension;
+		for (int i = 0; i < header->entry_num; i++) {
+			const coord_t* low = coords + i * width;
+			bool match = !box_records ? mbr.contains_point(low)
+				: pred == CONTAINED_IN ? mbr.contains(low, low + dimension)
+				: mbr.is_intersected(low, low + dimension);
+			if (match) {
+				result_cnt++;
+			}
+		}
+	}
+}
+
+
+//
+// query_point() on the frozen tree, reporting the same record as query_point_iterative().
+//
+bool RTree::query_point_frozen(const BoundingBox& mbr, Entry& result, QueryScratch& scratch) const
+{
+	vector<int>& stack = scratch.stack;
+	stack.clear();
+	stack.push_back(0);
+	while (!stack.empty()) {
+		const char* slot = frozen + (size_t)stack.back() * CACHE_LINE;
+		read_page(scratch.pages, stack.back());
+		stack.pop_back();
+		const FrozenHeader* header = (const FrozenHeader*)slot;
+		if (header->level != 0) {
+			push_frozen_children(slot, mbr, scratch);
+			continue;
+		}
+		const coord_t* coords = frozen_coords(slot);
+		const int* ids = (const int*)(slot + frozen_leaf_ids);
+		int width = box_records ? 2 * dimension : dimension;
+		for (int i = 0; i < header->entry_num; i++) {
+			const coord_t* low = coords + i * width;
+			const coord_t* high = low + width - dimension;
+			if (box_records ? mbr.is_intersected(low, high) : mbr.contains_point(low)) {
+				result.set_record(low, high, dimension, ids[i]);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+//
+// Helper function for the batch queries: answer the range queries of ``ranges'', or else the point
+// queries of ``points'', on the frozen tree by interleaving up to QUERY_GROUP_SIZE traversals, each
+// with its own stack. A traversal scans one slot, prefetches all the lines of the next slot it will
+// visit and yields to the next traversal, so the miss of each is overlapped by the work of the
+// others. Each traversal visits the slots query_range_frozen() does, in the same order.
+// A point query stops at its first matching record, stored in ``results'', as query_point_frozen() does.
+//
+void RTree::query_frozen_interleaved(const vector<BoundingBox>* ranges, const vector<vector<coord_t> >* points, RangePredicate pred, vector<int>& result_cnt, vector<int>& node_travelled, vector<Entry>* results)
+{
+	bool first_only = ranges == NULL;
+	int n = first_only ? points->size() : ranges->size();
+	result_cnt.assign(n, 0);
+	node_travelled.assign(n, 0);
+	size_t leaf_lines = (frozen_leaf_ids + max_leaf_num * sizeof(int) + CACHE_LINE - 1) / CACHE_LINE;
+	size_t inner_lines = (frozen_inner_ids + frozen_fanout * sizeof(int) + CACHE_LINE - 1) / CACHE_LINE;
+	size_t slot_lines = max(leaf_lines, inner_lines);
+	int width = box_records ? 2 * dimension : dimension;
+
+	int lanes = min(QUERY_GROUP_SIZE, n);
+	vector<QueryScratch> scratch(lanes);
+	vector<BoundingBox> point_box(first_only ? lanes : 0);
+	vector<const BoundingBox*> box(lanes);
+	vector<int> query(lanes, -1);
+	int next = 0;
+	int active = lanes;
+	while (active > 0) {
+		for (int l = 0; l < lanes; l++) {
+			vector<int>& stack = scratch[l].stack;
+			if (stack.empty()) { // the traversal is done: start the next query
+				if (query[l] == -2)
+					continue;
+				if (next == n) {
+					query[l] = -2;
+					active--;
+					continue;
+				}
+				query[l] = next++;
+				if (first_only) {
+					const coord_t* point = &(*points)[query[l]][0];
+					point_box[l].set_box(point, point, dimension);
+					box[l] = &point_box[l];
+				} else {
+					box[l] = &(*ranges)[query[l]];
+				}
+				stack.push_back(0);
+			}
+			int q = query[l];
+			int line = stack.back();
+			stack.pop_back();
+			const char* slot = frozen + (size_t)line * CACHE_LINE;
+			const FrozenHeader* header = (const FrozenHeader*)slot;
+			read_page(page_buffer, line);
+			node_travelled[q]++;
+			if (header->level != 0) {
+				push_frozen_children(slot, *box[l], scratch[l]);
+			} else {
+				const coord_t* coords = frozen_coords(slot);
+				const int* ids = (const int*)(slot + frozen_leaf_ids);
+				for (int i = 0; i < header->entry_num; i++) {
+					const coord_t* low = coords + i * width;
+					bool match = !box_records ? box[l]->contains_point(low)
+						: pred == CONTAINED_IN ? box[l]->contains(low, low + dimension)
+						: box[l]->is_intersected(low, low + dimension);
+					if (!match)
+						continue;
+					result_cnt[q]++;
+					if (first_only) {
+						(*results)[q].set_record(low, low + width - dimension, dimension, ids[i]);
+						stack.clear();
+						break;
+					}
+				}
+			}
+			if (!stack.empty()) {
+				const char* next_slot = frozen + (size_t)stack.back() * CACHE_LINE;
+				for (size_t k = 0; k < slot_lines; k++)
+					prefetch(next_slot + k * CACHE_LINE);
+			}
+		}
+	}
+}
+
+
+//
+// Helper function for query_range_shared(): the shared traversal of the frozen tree for the
+// ``group'' (at most 64) ranges of ``box'', testing entries as query_range_frozen() does.
+// Return: the number of slots visited.
+//
+int RTree::query_range_shared_frozen(const BoundingBox* box, int group, RangePredicate pred, int* result_count, int* node_travelled) const
+{
+	int width = box_records ? 2 * dimension : dimension;
+	vector<int> windows(frozen_bits != 0 ? group * 2 * dimension : 0);
+	vector<pair<int, unsigned long long> > stack;
+	stack.push_back(make_pair(0, group == 64 ? ~0ULL : (1ULL << group) - 1));
+	int shared_travelled = 0;
+	while (!stack.empty()) {
+		int line = stack.back().first;
+		unsigned long long active = stack.back().second;
+		stack.pop_back();
+		const char* slot = frozen + (size_t)line * CACHE_LINE;
+		const FrozenHeader* header = (const FrozenHeader*)slot;
+		const coord_t* coords = frozen_coords(slot);
+		shared_travelled++;
+		read_page(page_buffer, line);
+		for (int q = 0; q < group; q++) {
+			if (active >> q & 1)
+				node_travelled[q]++;
+		}
+		if (header->level == 0) {
+			for (int i = 0; i < header->entry_num; i++) {
+				const coord_t* low = coords + i * width;
+				for (int q = 0; q < group; q++) {
+					if (!(active >> q & 1))
+						continue;
+					bool match = !box_records ? box[q].contains_point(low)
+						: pred == CONTAINED_IN ? box[q].contains(low, low + dimension)
+						: box[q].is_intersected(low, low + dimension);
+					if (match)
+						result_count[q]++;
+				}
+			}
+			continue;
+		}
+		if (frozen_bits != 0) { // the window of each active query in the frame of the node
+			for (int q = 0; q < group; q++) {
+				if (active >> q & 1)
+					frozen_window(slot, box[q], dimension, frozen_bits, &windows[2 * q * dimension]);
+			}
+		}
+		const int* ids = (const int*)(slot + frozen_inner_ids);
+		for (int i = header->entry_num - 1; i >= 0; i--) {
+			const coord_t* low = coords + 2 * i * dimension;
+			unsigned long long child_active = 0;
+			for (int q = 0; q < group; q++) {
+				if (!(active >> q & 1))
+					continue;
+				bool hit = frozen_bits == 0 ? box[q].is_intersected(low, low + dimension)
+					: frozen_overlap(slot, i, &windows[2 * q * dimension], dimension, frozen_bits);
+				if (hit)
+					child_active |= 1ULL << q;
+			}
+			if (child_active != 0) {
+				prefetch(frozen + (size_t)ids[i] * CACHE_LINE);
+				stack.push_back(make_pair(ids[i], child_active));
+			}
+		}
+	}
+	return shared_travelled;
+}
+
+
+//
+// Make room in the summary for the ``child_num'' children of node ``i''. Return the index of the first.
+//
+int RTree::add_summary_children(int i, int child_num)
+{
+	int first = summary.record_num.size();
+	int n = first + child_num;
+	summary.corners.resize(n * 2 * dimension);
+	summary.record_num.resize(n);
+	summary.node_num.resize(n);
+	summary.first.resize(n);
+	summary.child_num.resize(n);
+	summary.first[i] = first;
+	summary.child_num[i] = child_num;
+	return first;
+}
+
+
+//
+// Fill in node ``i'' of the summary, whose MBR the caller stored, from ``node'' and the nodes below.
+// The children are kept for ``depth'' more levels; below, the subtree is only counted.
+//
+void RTree::summarize(RTNode* node, int i, int depth)
+{
+	if (node->level == 0 || depth == 0) {
+		int record_cnt = 0, node_cnt = 0;
+		stat(node, record_cnt, node_cnt);
+		summary.record_num[i] = record_cnt;
+		summary.node_num[i] = node_cnt;
+		summary.first[i] = -1;
+		summary.child_num[i] = 0;
+		return;
+	}
+	int first = add_summary_children(i, node->entry_num);
+	int width = 2 * dimension;
+	for (int j = 0; j < node->entry_num; j++) {
+		const BoundingBox& mbr = node->entries[j].get_mbr();
+		for (int k = 0; k < dimension; k++) {
+			summary.corners[(first + j) * width + k] = mbr.get_lowestValue_at(k);
+			summary.corners[(first + j) * width + dimension + k] = mbr.get_highestValue_at(k);
+		}
+	}
+
+	int record_cnt = 0, node_cnt = 1;
+	for (int j = 0; j < node->entry_num; j++) {
+		summarize(node->entries[j].get_ptr(), first + j, depth - 1);
+		record_cnt += summary.record_num[first + j];
+		node_cnt += summary.node_num[first + j];
+	}
+	summary.record_num[i] = record_cnt;
+	summary.node_num[i] = node_cnt;
+}
+
+
+//
+// summarize() for the slot at cache line ``line'' of a frozen tree. Quantized child MBRs are
+// mapped back from the frame of the node, rounded outward as they were stored.
+//
+void RTree::summarize_frozen(int line, int i, int depth)
+{
+	const char* slot = frozen + (size_t)line * CACHE_LINE;
+	const FrozenHeader* header = (const FrozenHeader*)slot;
+	if (header->level == 0 || depth == 0) {
+		int record_cnt = 0, node_cnt = 0;
+		count_frozen(line, record_cnt, node_cnt);
+		summary.record_num[i] = record_cnt;
+		summary.node_num[i] = node_cnt;
+		summary.first[i] = -1;
+		summary.child_num[i] = 0;
+		return;
+	}
+	int first = add_summary_children(i, header->entry_num);
+	for (int j = 0; j < header->entry_num; j++)
+		frozen_corners(slot, j, dimension, frozen_bits, &summary.corners[(first + j) * 2 * dimension]);
+
+	const int* ids = (const int*)(slot + frozen_inner_ids);
+	int record_cnt = 0, node_cnt = 1;
+	for (int j = 0; j < header->entry_num; j++) {
+		summarize_frozen(ids[j], first + j, depth - 1);
+		record_cnt += summary.record_num[first + j];
+		node_cnt += summary.node_num[first + j];
+	}
+	summary.record_num[i] = record_cnt;
+	summary.node_num[i] = node_cnt;
+}
+
+
+//
+// Count the records and the nodes of the frozen subtree at cache line ``line''.
+//
+void RTree::count_frozen(int line, int& record_cnt, int& node_cnt) const
+{
+	const FrozenHeader* header = (const FrozenHeader*)(frozen + (size_t)line * CACHE_LINE);
+	node_cnt++;
+	if (header->level == 0) {
+		record_cnt += header->entry_num;
+		return;
+	}
+	const int* ids = (const int*)((const char*)header + frozen_inner_ids);
+	for (int j = 0; j < header->entry_num; j++)
+		count_frozen(ids[j], record_cnt, node_cnt);
+}
+
+
+//
+// The MBR of the non-empty frozen slot at cache line ``line'': of its records or of its child
+// MBRs, stored as such in a slot with quantized child MBRs.
+//
+BoundingBox RTree::frozen_mbr(int line) const
+{
+	const char* slot = frozen + (size_t)line * CACHE_LINE;
+	const FrozenHeader* header = (const FrozenHeader*)slot;
+	const coord_t* coords = frozen_coords(slot);
+	if (header->level != 0 && frozen_bits != 0)
+		return BoundingBox(vector<coord_t>(coords, coords + dimension), vector<coord_t>(coords + dimension, coords + 2 * dimension));
+	int width = header->level != 0 ? 2 * dimension : box_records ? 2 * dimension : dimension;
+	vector<coord_t> lowest(coords, coords + dimension);
+	vector<coord_t> highest(coords + width - dimension, coords + width);
+	for (int j = 1; j < header->entry_num; j++) {
+		const coord_t* low = coords + j * width;
+		const coord_t* high = low + width - dimension;
+		for (int k = 0; k < dimension; k++) {
+			lowest[k] = min(lowest[k], low[k]);
+			highest[k] = max(highest[k], high[k]);
+		}
+	}
+	return BoundingBox(lowest, highest);
+}
+
+
+//
+// Helper function for estimate_range(): node ``i'' of the summary is visited. The records and the
+// nodes below a node whose children are not kept are taken as spread evenly over its MBR, so the
+// range holds its share of the volume; integer coordinates count as the unit cells they stand for.
+//
+void RTree::estimate_range(int i, const BoundingBox& mbr, double& result_cnt, int& node_travelled) const
+{
+	node_travelled++;
+	int width = 2 * dimension;
+	if (summary.first[i] < 0) {
+		const coord_t* low = &summary.corners[i * width];
+		const coord_t* high = low + dimension;
+		double unit = numeric_limits<coord_t>::is_integer ? 1 : 0;
+		double share = 1;
+		for (int k = 0; k < dimension && share > 0; k++) {
+			double extent = (double)high[k] - low[k] + unit;
+			double common = (double)min(high[k], mbr.get_highestValue_at(k)) - max(low[k], mbr.get_lowestValue_at(k)) + unit;
+			if (extent > 0)
+				share *= max(0.0, common) / extent;
+			else if (common < 0) // all records of the leaf on one value, outside the range
+				share = 0;
+		}
+		result_cnt += summary.record_num[i] * share;
+		node_travelled += (int)(share * (summary.node_num[i] - 1) + 0.5);
+		return;
+	}
+	int end = summary.first[i] + summary.child_num[i];
+	for (int c = summary.first[i]; c < end; c++) {
+		const coord_t* low = &summary.corners[c * width];
+		const coord_t* high = low + dimension;
+		if (!mbr.is_intersected(low, high))
+			continue;
+		if (mbr.contains(low, high)) { // the query would visit the whole subtree and report all of it
+			result_cnt += summary.record_num[c];
+			node_travelled += summary.node_num[c];
+		}
+		else {
+			estimate_range(c, mbr, result_cnt, node_travelled);
+		}
+	}
+}
+
+
+//
+// Estimate the number of results of query_range() with INTERSECTS, and of the nodes it visits,
+// without running it. The estimate walks a summary of the upper levels, see RangeSummary: a node
+// inside the range adds its records and nodes, and a node the range cuts at the bottom of the
+// summary adds its share of them, see estimate_range(int, ...). The summary keeps the levels down
+// to the one that could hold SUMMARY_NODES nodes at full fanout, and down to the leaves in smaller
+// trees, where only the leaves cut make the estimate inexact. It is made by a traversal of the tree,
+// or of its array if frozen, and made again once more than SUMMARY_STALE_FRACTION of the records
+// have changed since.
+//
+void RTree::estimate_range(const BoundingBox& mbr, double& result_count, int& node_travelled)
+{
+	result_count = 0;
+	node_travelled = 0;
+	if (mbr.get_dim() != this->dimension) {
+		cerr << "R-tree dimensionality inconsistency\n";
+		return;
+	}
+	int summary_records = summary.record_num.empty() ? 0 : summary.record_num[0];
+	if (!summary.built || summary.changes > summary_records * SUMMARY_STALE_FRACTION) {
+		flush_buffers();
+		summary.corners.clear();
+		summary.record_num.clear();
+		summary.node_num.clear();
+		summary.first.clear();
+		summary.child_num.clear();
+		int depth = 1;
+		long long fanout = frozen != NULL ? frozen_fanout : max_entry_num;
+		for (long long n = fanout; n * fanout <= SUMMARY_NODES; n *= fanout)
+			depth++;
+		if (frozen != NULL ? ((const FrozenHeader*)frozen)->entry_num > 0 : root->entry_num > 0) {
+			BoundingBox root_mbr = frozen != NULL ? frozen_mbr(0) : get_mbr(root);
+			summary.corners = root_mbr.get_lowest();
+			summary.corners.insert(summary.corners.end(), root_mbr.get_highest().begin(), root_mbr.get_highest().end());
+			summary.record_num.resize(1);
+			summary.node_num.resize(1);
+			summary.first.resize(1);
+			summary.child_num.resize(1);
+			if (frozen != NULL)
+				summarize_frozen(0, 0, depth);
+			else
+				summarize(root, 0, depth);
+		}
+		summary.built = true;
+		summary.changes = 0;
+	}
+	if (summary.record_num.empty()) { // an empty tree: only the root is visited
+		node_travelled = 1;
+		return;
+	}
+	estimate_range(0, mbr, result_count, node_travelled);
+}
+
+//
+// Range query that any number of threads may run at once while nobody updates the tree, each with
+// its own ``scratch''; see query_range(). A tree that is not frozen is walked iteratively.
+//
+void RTree::query_range(const BoundingBox& mbr, int& result_count, int& node_travelled, RangePredicate pred, QueryScratch& scratch) const
+{
+	result_count = 0;
+	node_travelled = 0;
+	if (frozen != NULL)
+		query_range_frozen(mbr, pred, result_count, node_travelled, scratch);
+	else
+		query_range_iterative(mbr, pred, result_count, node_travelled, scratch);
+}
+
+//
+// Point query that any number of threads may run at once, see query_range(..., QueryScratch&).
+//
+bool RTree::query_point(const vector<coord_t>& coordinate, Entry& result, QueryScratch& scratch) const
+{
+	BoundingBox mbr(coordinate, coordinate);
+	if (frozen != NULL)
+		return query_point_frozen(mbr, result, scratch);
+	return query_point_iterative(mbr, result, scratch);
+}
+
+
+
+//
+// Capacities at which ``bytes''-sized entries fill 1, 2, 4, ... cache lines, up to a page.
+//
+static vector<int> line_capacities(size_t bytes)
+{
+	vector<int> capacities;
+	for (size_t lines = 1; lines * CACHE_LINE <= BASE_PAGE; lines *= 2) {
+		int capacity = lines * CACHE_LINE / bytes;
+		if (capacity >= 3 && (capacities.empty() || capacities.back() != capacity))
+			capacities.push_back(capacity);
+	}
+	return capacities;
+}
+
+
+// CPU seconds to insert ``sample'' one record at a time and answer ``queries'' with the given capacities.
+static double time_workload(int leaf, int internal, int dim, const vector<vector<coord_t> >& sample, const vector<BoundingBox>& queries)
+{
+	clock_t start = clock();
+	RTree tree(leaf, internal, dim);
+	for (int i = 0; i < sample.size(); i++) {
+		tree.insert(sample[i], i);
+	}
+	for (int i = 0; i < queries.size(); i++) {
+		int result_count = 0, node_travelled = 0;
+		tree.query_range(queries[i], result_count, node_travelled);
+	}
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+//
+// Pick leaf and internal node capacities for a workload by timing it on trees of candidate capacities.
+// The workload inserts the points of ``sample'' and then answers the range queries of ``queries''.
+// Candidates fill whole cache lines, from one line up to a page, with the bytes a search reads
+// per entry: a packed point and its record id in a leaf, the two corners of the MBR of a child
+// and its pointer in an internal node. The leaf capacities are timed first with the median
+// internal candidate, then the internal capacities with the best leaf capacity.
+//
+NodeCapacity RTree::calibrate(int dim, const vector<vector<coord_t> >& sample, const vector<BoundingBox>& queries)
+{
+	vector<int> leaves = line_capacities(dim * sizeof(coord_t) + sizeof(int));
+	vector<int> internals = line_capacities(2 * dim * sizeof(coord_t) + sizeof(RTNode*));
+	NodeCapacity best;
+	best.internal = internals[internals.size() / 2];
+	best.leaf = leaves[0];
+
+	double best_time = -1;
+	for (int i = 0; i < leaves.size(); i++) {
+		double t = time_workload(leaves[i], best.internal, dim, sample, queries);
+		if (best_time < 0 || t < best_time) {
+			best_time = t;
+			best.leaf = leaves[i];
+		}
+	}
+	for (int i = 0; i < internals.size(); i++) {
+		double t = time_workload(best.leaf, internals[i], dim, sample, queries);
+		if (t < best_time) {
+			best_time = t;
+			best.internal = internals[i];
+		}
+	}
+	return best;
+}
+
+
+// A pair of records found by a join, kept as their leaves and positions until it is reported.
+struct JoinPair {
+	const RTNode* leaf;
+	int i;
+	const RTNode* other_leaf;
+	int j;
+};
+
+// A pair of subtrees still to join, with their MBRs.
+struct JoinTask {
+	const RTNode* n1;
+	const coord_t* low1;
+	const coord_t* high1;
+	const RTNode* n2;
+	const coord_t* low2;
+	const coord_t* high2;
+};
+
+//
+// State of a spatial join, shared by the node pairs of join_nodes().
+// Pairs go to ``visitor'' unless ``pairs'' collects them; with ``tasks'', subtree pairs are
+// queued there instead of being joined.
+//
+struct JoinContext {
+	JoinContext(int d = 0, JoinPredicate p = JOIN_INTERSECTS, double dist = 0, JoinVisitor* v = NULL)
+		: dim(d), pred(p), distance(dist), visitor(v), pairs(NULL), tasks(NULL), pair_cnt(0), node_pair_cnt(0) {}
+	int dim;
+	JoinPredicate pred;
+	double distance;
+	JoinVisitor* visitor;
+	vector<JoinPair>* pairs;
+	vector<JoinTask>* tasks;
+	Entry record;		// the records of the pair reported to ``visitor''
+	Entry other_record;
+	long long pair_cnt;
+	int node_pair_cnt;
+};
+
+// Corners of the i-th entry of ``node'': a record of a leaf, or the MBR of a child.
+static inline const coord_t* entry_low(const RTNode* node, int i)
+{
+	return node->level == 0 ? node->get_point(i) : &node->entries[i].get_mbr().get_lowest()[0];
+}
+
+static inline const coord_t* entry_high(const RTNode* node, int i)
+{
+	return node->level == 0 ? node->get_high(i) : &node->entries[i].get_mbr().get_highest()[0];
+}
+
+// Whether the boxes [low1, high1] and [low2, high2] satisfy the join predicate; for
+// JOIN_WITHIN_DISTANCE, whether their Euclidean distance is at most ``distance''.
+static inline bool join_match(const JoinContext& ctx, const coord_t* low1, const coord_t* high1, const coord_t* low2, const coord_t* high2)
+{
+	if (ctx.pred == JOIN_INTERSECTS) {
+		for (int k = 0; k < ctx.dim; k++) {
+			if (low1[k] > high2[k] || low2[k] > high1[k])
+				return false;
+		}
 		return true;
 	}
+	double sum = 0;
+	for (int k = 0; k < ctx.dim; k++) {
+		double gap = max(0.0, max((double)low1[k] - high2[k], (double)low2[k] - high1[k]));
+		sum += gap * gap;
+		if (sum > ctx.distance * ctx.distance)
+			return false;
+	}
+	return true;
+}
 
-	
-	// split is needed.
-	bool split = true;
-	RTNode* node = leaf;
-	Entry new_entry = e;
-	while (split) {
-		Entry* entry_buffer = new Entry[node->entry_num + 1];
-		for (int i = 0; i < node->entry_num; i++) {
-			entry_buffer[i] = node->entries[i];
-		}
-		entry_buffer[max_entry_num] = new_entry;
-
-		int m1, m2;
-		linear_pick_seeds(entry_buffer, max_entry_num+1, m1, m2);
-
-		RTNode* new_node = new RTNode(node->level, max_entry_num);
-		node->entries[0] = entry_buffer[m1];
-		node->entry_num=1;
-		new_node->entries[0] = entry_buffer[m2];
-		new_node->entry_num = 1;
-		// move the selected nodes to the end of the buffer
-		swap_entry(entry_buffer, m2, max_entry_num);
-		if (m1 == max_entry_num) {
-			m1 = m2;
-		}
-		swap_entry(entry_buffer, m1, max_entry_num-1);
-		// (bubble) sort the entries in the remaining set
-		// last one should be picked first.
-		int remain = max_entry_num-1;
-		for (int i = 1; i < remain; i++) {
-			for (int j = 0; j < remain - i; j++) {
-				if (tie_breaking(entry_buffer[j].get_mbr(), entry_buffer[j+1].get_mbr())) {
-					swap_entry(entry_buffer, j, j+1);
-				}
-			}
+// The entries of ``node'' that may pair with something inside [low, high], ordered by their
+// lowest value on the first dimension, for the plane sweep.
+static void sweep_list(const JoinContext& ctx, const RTNode* node, const coord_t* low, const coord_t* high, vector<pair<coord_t, int> >& list)
+{
+	for (int i = 0; i < node->entry_num; i++) {
+		if (join_match(ctx, entry_low(node, i), entry_high(node, i), low, high))
+			list.push_back(make_pair(entry_low(node, i)[0], i));
+	}
+	sort(list.begin(), list.end());
+}
+
+static void join_nodes(JoinContext& ctx, const RTNode* n1, const coord_t* low1, const coord_t* high1, const RTNode* n2, const coord_t* low2, const coord_t* high2);
+
+// Join the subtrees at ``n1'' and ``n2'', or queue them as a task while the join is partitioned.
+static void join_subtrees(JoinContext& ctx, const RTNode* n1, const coord_t* low1, const coord_t* high1, const RTNode* n2, const coord_t* low2, const coord_t* high2)
+{
+	if (ctx.tasks != NULL) {
+		JoinTask task = { n1, low1, high1, n2, low2, high2 };
+		ctx.tasks->push_back(task);
+	}
+	else {
+		join_nodes(ctx, n1, low1, high1, n2, low2, high2);
+	}
+}
+
+// Join entries ``i'' of ``n1'' and ``j'' of ``n2'': report two records, or descend into two children.
+static void join_entries(JoinContext& ctx, const RTNode* n1, int i, const RTNode* n2, int j)
+{
+	const coord_t* low1 = entry_low(n1, i);
+	const coord_t* high1 = entry_high(n1, i);
+	const coord_t* low2 = entry_low(n2, j);
+	const coord_t* high2 = entry_high(n2, j);
+	if (!join_match(ctx, low1, high1, low2, high2))
+		return;
+	if (n1->level == 0) {
+		ctx.pair_cnt++;
+		if (ctx.pairs != NULL) {
+			JoinPair found = { n1, i, n2, j };
+			ctx.pairs->push_back(found);
 		}
-		// split procedure
-		int max_split_size = (max_entry_num) / 2 + 1;
-		BoundingBox old_mbr = node->entries[0].get_mbr();
-		BoundingBox new_mbr = new_node->entries[0].get_mbr();
-		while (node->entry_num < max_split_size && new_node->entry_num < max_split_size) {
-			int old_inc = area_inc(old_mbr, entry_buffer[remain-1].get_mbr());
-			int new_inc = area_inc(new_mbr, entry_buffer[remain-1].get_mbr());
-			bool add_to_old = false;
-			if (old_inc != new_inc) // less enlargement better.
-				add_to_old = old_inc < new_inc;
-			else if (area(old_mbr) != area(new_mbr)) // smaller area better.
-				add_to_old = area(old_mbr) < area(new_mbr);
-			else if (node->entry_num != new_node->entry_num) // fewer entries num better.
-				add_to_old = node->entry_num < new_node->entry_num;
-			else 
-				add_to_old = tie_breaking(old_mbr, new_mbr);
-
-			if (add_to_old) {
-				node->entries[node->entry_num] = entry_buffer[remain-1];
-				node->entry_num++;
-				update_mbr(old_mbr, entry_buffer[remain-1].get_mbr());
-			}
-			else {
-				new_node->entries[new_node->entry_num] = entry_buffer[remain-1];
-				new_node->entry_num++;
-				update_mbr(new_mbr, entry_buffer[remain-1].get_mbr());
-			}
-			remain--;
+		else if (ctx.visitor != NULL) {
+			n1->get_record(i, ctx.record);
+			n2->get_record(j, ctx.other_record);
+			ctx.visitor->visit(ctx.record, ctx.other_record);
 		}
-		
-		// one node reaches max num nodes, assign the remaining to the other node
-		if (node->entry_num == max_split_size) {
-			for (int i = remain-1; i >= 0; i--) {
-				new_node->entries[new_node->entry_num] = entry_buffer[i];
-				new_node->entry_num++;
-				update_mbr(new_mbr, entry_buffer[i].get_mbr());
-			}
+	}
+	else {
+		join_subtrees(ctx, n1->entries[i].get_ptr(), low1, high1, n2->entries[j].get_ptr(), low2, high2);
+	}
+}
+
+//
+// Helper function for RTree::join(). Join the subtrees at ``n1'' and ``n2'', whose MBRs are given.
+// Only entries that may pair with something in the MBR of the other node take part, and the
+// candidate pairs come from a plane sweep along the first dimension. When the nodes are on different
+// levels, the higher one is descended alone.
+//
+static void join_nodes(JoinContext& ctx, const RTNode* n1, const coord_t* low1, const coord_t* high1, const RTNode* n2, const coord_t* low2, const coord_t* high2)
+{
+	ctx.node_pair_cnt++;
+	if (n1->level > n2->level) {
+		for (int i = 0; i < n1->entry_num; i++) {
+			const coord_t* low = entry_low(n1, i);
+			const coord_t* high = entry_high(n1, i);
+			if (join_match(ctx, low, high, low2, high2))
+				join_subtrees(ctx, n1->entries[i].get_ptr(), low, high, n2, low2, high2);
 		}
-		else {
-			for (int i = remain-1; i >= 0; i--) {
-				node->entries[node->entry_num] = entry_buffer[i];
-				node->entry_num++;
-				update_mbr(old_mbr, entry_buffer[i].get_mbr());
-			}
+		return;
+	}
+	if (n2->level > n1->level) {
+		for (int j = 0; j < n2->entry_num; j++) {
+			const coord_t* low = entry_low(n2, j);
+			const coord_t* high = entry_high(n2, j);
+			if (join_match(ctx, low1, high1, low, high))
+				join_subtrees(ctx, n1, low1, high1, n2->entries[j].get_ptr(), low, high);
 		}
-		// two nodes now. go to a higher level
-		if (stack_size == 0) {
-			// root reached.
-			RTNode* new_root = new RTNode(node->level+1, max_entry_num);
-			new_root->entries[0].set_mbr(old_mbr);
-			new_root->entries[0].set_ptr(node);
-			new_root->entries[1].set_mbr(new_mbr);
-			new_root->entries[1].set_ptr(new_node);
-			new_root->entry_num = 2;
-			root = new_root;
-			split = false;
+		return;
+	}
+
+	vector<pair<coord_t, int> > list1, list2;
+	sweep_list(ctx, n1, low2, high2, list1);
+	sweep_list(ctx, n2, low1, high1, list2);
+	double reach = ctx.pred == JOIN_WITHIN_DISTANCE ? ctx.distance : 0;
+	int i = 0, j = 0;
+	while (i < list1.size() && j < list2.size()) {
+		if (list1[i].first <= list2[j].first) {
+			double end = entry_high(n1, list1[i].second)[0] + reach;
+			for (int k = j; k < list2.size() && list2[k].first <= end; k++)
+				join_entries(ctx, n1, list1[i].second, n2, list2[k].second);
+			i++;
 		}
 		else {
-			stack_size--;
-			RTNode* parent = stack[stack_size];
-			int idx = entry_idx[stack_size];
-			parent->entries[idx].set_mbr(old_mbr);
-			new_entry.set_mbr(new_mbr);
-			new_entry.set_ptr(new_node);
-			if (parent->entry_num < max_entry_num) {
-				parent->entries[parent->entry_num] = new_entry;
-				parent->entry_num++;
-				split = false;
-			}
-			else
-				node = parent;
+			double end = entry_high(n2, list2[j].second)[0] + reach;
+			for (int k = i; k < list1.size() && list1[k].first <= end; k++)
+				join_entries(ctx, n1, list1[k].second, n2, list2[j].second);
+			j++;
 		}
+	}
+}
 
-		delete []entry_buffer;
+
+//
+// Spatial join with ``other'' by synchronized traversal of both trees: report each pair of a record
+// of this tree and a record of ``other'' that intersect (JOIN_INTERSECTS) or lie within ``distance''
+// of each other (JOIN_WITHIN_DISTANCE) to ``visitor'', if not NULL.
+// Return: number of pairs in ``pair_count''.
+//		number of node pairs visited in ``node_travelled''.
+//
+void RTree::join(const RTree& other, JoinPredicate pred, double distance, JoinVisitor* visitor, long long& pair_count, int& node_travelled)
+{
+	pair_count = 0;
+	node_travelled = 0;
+	if (other.dimension != dimension) {
+		cerr << "R-tree dimensionality inconsistency\n";
+		return;
 	}
-	adjust_tree(stack, entry_idx, stack_size);
+	if (other.frozen != NULL) {
+		cerr << "Cannot join with a frozen R-tree\n";
+		return;
+	}
+	if (other.buffered_num > 0) {
+		cerr << "Cannot join with an R-tree holding buffered records\n";
+		return;
+	}
+	thaw();
+	flush_buffers();
+	if (root->entry_num == 0 || other.root->entry_num == 0)
+		return;
 
-	delete []stack;
-	delete []entry_idx;
-	return true;
+	JoinContext ctx(dimension, pred, distance, visitor);
+	BoundingBox mbr1 = get_mbr(root);
+	BoundingBox mbr2 = get_mbr(other.root);
+	join_nodes(ctx, root, &mbr1.get_lowest()[0], &mbr1.get_highest()[0], other.root, &mbr2.get_lowest()[0], &mbr2.get_highest()[0]);
+	pair_count = ctx.pair_cnt;
+	node_travelled = ctx.node_pair_cnt;
 }
 
-static bool compare_node(RTNode *x, RTNode *y)
+
+//
+// A worker of join_parallel(). It runs the tasks of its own queue from the back, then steals
+// from the front of the queues of the other workers. Pairs are counted, and collected in
+// ``pairs'' for the visitor, per worker.
+//
+struct JoinWorker {
+	int id;
+	vector<JoinWorker>* all;
+	JoinContext ctx;
+	vector<JoinPair> pairs;
+	deque<JoinTask> queue;
+	pthread_mutex_t lock;
+};
+
+static bool next_join_task(JoinWorker& worker, JoinTask& task)
 {
-    return x->level > y->level;
+	vector<JoinWorker>& all = *worker.all;
+	for (int k = 0; k < all.size(); k++) {
+		JoinWorker& victim = all[(worker.id + k) % all.size()];
+		pthread_mutex_lock(&victim.lock);
+		bool found = !victim.queue.empty();
+		if (found && k == 0) {
+			task = victim.queue.back();
+			victim.queue.pop_back();
+		}
+		else if (found) {
+			task = victim.queue.front();
+			victim.queue.pop_front();
+		}
+		pthread_mutex_unlock(&victim.lock);
+		if (found)
+			return true;
+	}
+	return false;
 }
 
-static bool compare_entry(Entry x, Entry y)
+static void* run_join_worker(void* arg)
 {
-    RTree t(2);
-    return t.tie_breaking(x.get_mbr(), y.get_mbr());
+	JoinWorker& worker = *(JoinWorker*)arg;
+	JoinTask task;
+	while (next_join_task(worker, task))
+		join_nodes(worker.ctx, task.n1, task.low1, task.high1, task.n2, task.low2, task.high2);
+	return NULL;
 }
 
-void RTree::condense_tree(RTNode* L, RTNode** stack, int* entry_idx, int stack_size)
+
+//
+// join() on ``thread_num'' threads. The node pairs of the upper levels are expanded breadth-first
+// into independent subtree pairs, until there are JOIN_TASKS_PER_THREAD per thread, and those are
+// dealt round-robin to the workers (see JoinWorker). Each record pair lies under exactly one task,
+// so the pairs collected by the workers are reported to ``visitor'' without duplicates once all
+// threads are done, from the calling thread.
+//
+void RTree::join_parallel(const RTree& other, JoinPredicate pred, double distance, JoinVisitor* visitor, long long& pair_count, int& node_travelled, int thread_num)
 {
-    RTNode* N=L;
-    
-    vector<RTNode*> Q;  //the set of eliminated nodes, initially empty
-    while (N!=this->root){
-        int EN=entry_idx[stack_size];
-        RTNode* P=stack[stack_size];
-        
-        if (N->entry_num<ceil(0.5*max_entry_num)){  //if N has fewer than m entries
-            
-            swap_entry(P->entries, EN, P->entry_num-1);
-            P->entry_num--;
-            Q.push_back(N);
-        }
-        else{  //if N has not been eliminated, adjust EnI to tightly contain all entries in N
-            BoundingBox new_box(get_mbr(N->entries,N->entry_num));
-            P->entries[EN].set_mbr(new_box);
-        }
-        N=P; //set N=P and repeat
-        stack_size--;
-    }
-    sort(Q.begin(), Q.end(), compare_node); //higher level nodes first
-    for (int i = 0; i < Q.size(); i++)
-    {
-      sort(Q.at(i)->entries, Q.at(i)->entries + Q.at(i)->entry_num, compare_entry); //tie_breaking between entries
-      for (int j = 0; j < Q.at(i)->entry_num; j++)
-	insert(Q.at(i)->entries[j], Q.at(i)->level); //higher entries must be placed higher
-    }
+	pair_count = 0;
+	node_travelled = 0;
+	if (other.dimension != dimension) {
+		cerr << "R-tree dimensionality inconsistency\n";
+		return;
+	}
+	if (other.frozen != NULL) {
+		cerr << "Cannot join with a frozen R-tree\n";
+		return;
+	}
+	if (other.buffered_num > 0) {
+		cerr << "Cannot join with an R-tree holding buffered records\n";
+		return;
+	}
+	thaw();
+	flush_buffers();
+	if (root->entry_num == 0 || other.root->entry_num == 0)
+		return;
+	thread_num = max(thread_num, 1);
+
+	JoinContext ctx(dimension, pred, distance, visitor);
+	BoundingBox mbr1 = get_mbr(root);
+	BoundingBox mbr2 = get_mbr(other.root);
+	JoinTask root_task = { root, &mbr1.get_lowest()[0], &mbr1.get_highest()[0], other.root, &mbr2.get_lowest()[0], &mbr2.get_highest()[0] };
+	vector<JoinTask> tasks(1, root_task);
+	while (tasks.size() < JOIN_TASKS_PER_THREAD * thread_num) {
+		vector<JoinTask> next;
+		bool split = false;
+		ctx.tasks = &next;
+		for (int i = 0; i < tasks.size(); i++) {
+			const JoinTask& t = tasks[i];
+			if (t.n1->level == 0 && t.n2->level == 0) {
+				next.push_back(t);
+			}
+			else {
+				join_nodes(ctx, t.n1, t.low1, t.high1, t.n2, t.low2, t.high2);
+				split = true;
+			}
+		}
+		tasks.swap(next);
+		if (!split)
+			break;
+	}
+	ctx.tasks = NULL;
+
+	vector<JoinWorker> workers(thread_num);
+	for (int i = 0; i < thread_num; i++) {
+		workers[i].id = i;
+		workers[i].all = &workers;
+		workers[i].ctx = JoinContext(dimension, pred, distance, visitor);
+		if (visitor != NULL)
+			workers[i].ctx.pairs = &workers[i].pairs;
+		pthread_mutex_init(&workers[i].lock, NULL);
+	}
+	for (int i = 0; i < tasks.size(); i++)
+		workers[i % thread_num].queue.push_back(tasks[i]);
+
+	// the calling thread is worker 0; it also drains the queues of threads that failed to start
+	vector<pthread_t> threads(thread_num);
+	vector<bool> started(thread_num, false);
+	for (int i = 1; i < thread_num; i++)
+		started[i] = pthread_create(&threads[i], NULL, run_join_worker, &workers[i]) == 0;
+	run_join_worker(&workers[0]);
+	for (int i = 1; i < thread_num; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+	}
+
+	pair_count = ctx.pair_cnt;
+	node_travelled = ctx.node_pair_cnt;
+	for (int i = 0; i < thread_num; i++) {
+		JoinWorker& worker = workers[i];
+		pair_count += worker.ctx.pair_cnt;
+		node_travelled += worker.ctx.node_pair_cnt;
+		for (int k = 0; k < worker.pairs.size(); k++) {
+			const JoinPair& found = worker.pairs[k];
+			found.leaf->get_record(found.i, ctx.record);
+			found.other_leaf->get_record(found.j, ctx.other_record);
+			visitor->visit(ctx.record, ctx.other_record);
+		}
+		pthread_mutex_destroy(&worker.lock);
+	}
 }
 
-bool RTree::del(const vector<int>& coordinate)
+
+//
+// Whether the box [low, high] comes within ``radius'' of ``center'' under ``metric'', i.e. whether
+// its MINDIST to ``center'' is at most ``radius''. L2 compares squared distances.
+//
+static inline bool within_radius(const coord_t* center, const coord_t* low, const coord_t* high, int dim, DistanceMetric metric, double radius)
 {
-	if (coordinate.size() != this->dimension)
-	{
+	double bound = metric == METRIC_L2 ? radius * radius : radius;
+	double dist = 0;
+	for (int k = 0; k < dim; k++) {
+		double gap = max(0.0, max((double)low[k] - center[k], (double)center[k] - high[k]));
+		if (metric == METRIC_L1)
+			dist += gap;
+		else if (metric == METRIC_L2)
+			dist += gap * gap;
+		else
+			dist = max(dist, gap);
+		if (dist > bound)
+			return false;
+	}
+	return true;
+}
+
+
+//
+// Find the records within ``radius'' of ``center'' under ``metric'' (for a rectangle record, the
+// nearest point of it). Internal entries are pruned by the MINDIST of their MBR, and leaf records
+// are filtered exactly, so no record outside the radius is reported. The records waiting in the
+// buffers of internal nodes are filtered the same way.
+// Return: number of results in ``result_count''.
+//		number of R-tree nodes traveled in ``node_travelled''.
+//
+void RTree::query_radius(const vector<coord_t>& center, double radius, DistanceMetric metric, int& result_count, int& node_travelled)
+{
+	result_count = 0;
+	node_travelled = 0;
+	if (center.size() != dimension) {
 		cerr << "R-tree dimensionality inconsistency\n";
+		return;
 	}
-    RTNode* stack[20];
-    int entry_idx[20];
-    int stack_size=1;
-    
-    BoundingBox B(coordinate,coordinate);
-    Entry E(B,1);
-    RTNode* L=find_leaf(this->root, stack, entry_idx, stack_size, E); //Find the leaf node and delete the ``record''.
-    
-//    
-//    RTNode* L=this->root->find_leaf(coordinate,index); //T could be the found leaf or NULL
-    stack_size--;
-    if (L==NULL) {
-      // cout<<"Deleting ";
-      //  B.print();
-      //  cout<<" but failed find_leaf()\n";
-        return false; //if there is no such entry
-        
-    }
-    else{ //swap E with the last entry of L(if needed), then remove the last entry of L from L
+	const coord_t* point = &center[0];
+	if (frozen != NULL) {
+		query_radius_frozen(point, radius, metric, result_count, node_travelled);
+		return;
+	}
+	vector<const RTNode*>& stack = query_scratch.nodes;
+	stack.clear();
+	stack.push_back(root);
+	while (!stack.empty()) {
+		const RTNode* node = stack.back();
+		stack.pop_back();
+		if (!stack.empty())
+			prefetch_content(stack.back());
+		node_travelled++;
+		read_page(page_buffer, node->page);
+		if (node->level == 0) {
+			for (int i = 0; i < node->entry_num; i++) {
+				if (within_radius(point, node->get_point(i), node->get_high(i), dimension, metric, radius))
+					result_count++;
+			}
+		} else {
+			for (int i = 0; i < node->buffer.size(); i++) {
+				const BoundingBox& mbr = node->buffer[i].get_mbr();
+				if (within_radius(point, &mbr.get_lowest()[0], &mbr.get_highest()[0], dimension, metric, radius))
+					result_count++;
+			}
+			for (int i = node->entry_num - 1; i >= 0; i--) {
+				const BoundingBox& mbr = node->entries[i].get_mbr();
+				if (within_radius(point, &mbr.get_lowest()[0], &mbr.get_highest()[0], dimension, metric, radius)) {
+					const RTNode* child = node->entries[i].get_ptr();
+					prefetch(child);
+					stack.push_back(child);
+				}
+			}
+		}
+	}
+}
 
-        condense_tree(L,stack,entry_idx, stack_size); //Invoke CondenseTree, passing L
-        if (this->root->entry_num==1&&this->root->level!=0){ //D4
-            this->root=this->root->entries[0].get_ptr();
-        }
-    }
-    return true;
-    
-    
+
+//
+// query_radius() on the frozen tree. Quantized child MBRs are mapped back and rounded outward
+// before the MINDIST test, so rounding may only let extra children through.
+//
+void RTree::query_radius_frozen(const coord_t* center, double radius, DistanceMetric metric, int& result_count, int& node_travelled)
+{
+	int width = box_records ? 2 * dimension : dimension;
+	vector<coord_t> corners(2 * dimension);
+	vector<int>& stack = query_scratch.stack;
+	stack.clear();
+	stack.push_back(0);
+	while (!stack.empty()) {
+		const char* slot = frozen + (size_t)stack.back() * CACHE_LINE;
+		read_page(page_buffer, stack.back());
+		stack.pop_back();
+		const FrozenHeader* header = (const FrozenHeader*)slot;
+		node_travelled++;
+		if (header->level == 0) {
+			const coord_t* coords = frozen_coords(slot);
+			for (int i = 0; i < header->entry_num; i++) {
+				const coord_t* low = coords + i * width;
+				if (within_radius(center, low, low + width - dimension, dimension, metric, radius))
+					result_count++;
+			}
+			continue;
+		}
+		const int* ids = (const int*)(slot + frozen_inner_ids);
+		for (int i = header->entry_num - 1; i >= 0; i--) {
+			frozen_corners(slot, i, dimension, frozen_bits, &corners[0]);
+			if (within_radius(center, &corners[0], &corners[dimension], dimension, metric, radius)) {
+				prefetch(frozen + (size_t)ids[i] * CACHE_LINE);
+				stack.push_back(ids[i]);
+			}
+		}
+	}
 }
 
 
-void RTree::query_range(const BoundingBox& mbr, int& result_count, int& node_travelled)
+//
+// An entry waiting in the heap of skyline(): a record of a leaf, or the child of an internal node,
+// keyed on the L1 norm of its lowest corner. ``seq'' keeps the order of equal keys deterministic.
+//
+struct SkylineItem {
+	area_t key;
+	long long seq;
+	const RTNode* node;
+	int i;
+	bool operator<(const SkylineItem& other) const
+	{
+		return key != other.key ? key > other.key : seq > other.seq;
+	}
+};
+
+// Whether ``p'' dominates ``q'': no larger on any dimension and smaller on at least one.
+static inline bool dominates(const coord_t* p, const coord_t* q, int dim)
 {
-	
-	result_count = 0;
+	bool smaller = false;
+	for (int k = 0; k < dim; k++) {
+		if (p[k] > q[k])
+			return false;
+		if (p[k] < q[k])
+			smaller = true;
+	}
+	return smaller;
+}
+
+static bool dominated(const vector<Entry>& skyline, const coord_t* low, int dim)
+{
+	for (int i = 0; i < skyline.size(); i++) {
+		if (dominates(&skyline[i].get_mbr().get_lowest()[0], low, dim))
+			return true;
+	}
+	return false;
+}
+
+
+//
+// Skyline by branch-and-bound (BBS): the records not dominated by any other record, smaller
+// values being better on every dimension. Rectangle records are compared by their lowest corner.
+// Entries are taken from a min-heap in the order of the L1 norm of their lowest corner, so a record
+// is only dominated by records taken before it, and an entry whose lowest corner is dominated by
+// the skyline so far is dropped with its whole subtree.
+// Return: the skyline records in ``result'', by increasing L1 norm.
+//		number of R-tree nodes visited in ``node_travelled''.
+//
+void RTree::skyline(vector<Entry>& result, int& node_travelled)
+{
+	result.clear();
 	node_travelled = 0;
-	query_range(root, mbr, result_count, node_travelled);
+	thaw();
+	flush_buffers();
+
+	priority_queue<SkylineItem> heap;
+	long long seq = 0;
+	const RTNode* node = root;
+	while (true) {
+		node_travelled++;
+		read_page(page_buffer, node->page);
+		for (int i = 0; i < node->entry_num; i++) {
+			const coord_t* low = entry_low(node, i);
+			if (dominated(result, low, dimension))
+				continue;
+			SkylineItem item = { 0, seq++, node, i };
+			for (int k = 0; k < dimension; k++)
+				item.key += low[k];
+			heap.push(item);
+		}
+
+		node = NULL;
+		while (node == NULL && !heap.empty()) {
+			SkylineItem item = heap.top();
+			heap.pop();
+			if (dominated(result, entry_low(item.node, item.i), dimension))
+				continue;
+			if (item.node->level != 0) {
+				node = item.node->entries[item.i].get_ptr();
+			}
+			else {
+				result.push_back(Entry());
+				item.node->get_record(item.i, result.back());
+			}
+		}
+		if (node == NULL)
+			break;
+	}
 }
 
 
-bool RTree::query_point(const vector<int>& coordinate, Entry& result)
+NodeCapacity RTree::capacity() const
 {
-	BoundingBox mbr(coordinate, coordinate);
-	return query_point(root, mbr, result);
+	NodeCapacity capacity;
+	capacity.leaf = max_leaf_num;
+	capacity.internal = max_entry_num;
+	return capacity;
 }
 
 
@@ -652,7 +4200,7 @@ void RTree::stat()
 
 void RTree::print_node(RTNode* node, int indent_level)
 {
-	BoundingBox mbr = get_mbr(node->entries, node->entry_num);
+	BoundingBox mbr = get_mbr(node);
 
 	char* indent = new char[4*indent_level+1];
 	memset(indent, ' ', sizeof(char) * 4 * indent_level);
@@ -686,7 +4234,10 @@ void RTree::print_node(RTNode* node, int indent_level)
 
 	Entry *copy = new Entry[node->entry_num];
 	for (int i = 0; i < node->entry_num; i++) {
-		copy[i] = node->entries[i];
+		if (node->level == 0)
+			node->get_record(i, copy[i]);
+		else
+			copy[i] = node->entries[i];
 	}
 
 	for (int i = 0; i < node->entry_num; i++) {
@@ -704,6 +4255,10 @@ void RTree::print_node(RTNode* node, int indent_level)
 			{
 				cout << e.get_mbr().get_lowestValue_at(i) << ", ";
 			}
+			for (int i = 0; node->boxes && i < e.get_mbr().get_dim(); i++)
+			{
+				cout << e.get_mbr().get_highestValue_at(i) << ", ";
+			}
 			cout << e.get_rid() << ">\n";
 		}
 		else {
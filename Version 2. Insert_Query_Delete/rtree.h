@@ -1,45 +1,237 @@
 /* Definitions of major classes */ 
 
+// guarded, as each layer of trees (sharded, log-structured, replicated) includes it
+#ifndef RTREE_H
+#define RTREE_H
+
 #include "rtnode.h"
+#include "pagebuffer.h"
 #include <vector>
+#include <unordered_set>
+
+// Which records a range query reports: those intersecting the range, or those lying inside it.
+// The two are the same for point records.
+enum RangePredicate { INTERSECTS, CONTAINED_IN };
+
+// How a tree places its records: by the least-enlargement descent and the linear split of
+// Guttman's R-tree, or in Hilbert order with deferred splits, see RTree::hilbert_insert().
+enum TreeEngine { GUTTMAN_ENGINE, HILBERT_ENGINE };
+
+// Order of the nodes in the array of a frozen tree, see RTree::freeze().
+enum FrozenLayout { BREADTH_FIRST, VAN_EMDE_BOAS };
+
+// Scratch space of the queries of a tree. Each thread querying a tree shared with others
+// brings its own, see RTree::query_range(..., QueryScratch&).
+struct QueryScratch {
+	vector<const RTNode*> nodes;	// nodes still to visit
+	vector<int> stack;		// slots still to visit in a frozen tree
+	vector<int> window;		// the query range in the quantized frame of a frozen node
+	PageBuffer* pages;		// counts the nodes visited as page accesses, if not NULL
+
+	QueryScratch() : pages(NULL) {}
+};
+
+// Counts of the nodes of the top levels of an RTree for RTree::estimate_range(): the MBR of each
+// node and the records and nodes below it, without the records themselves. The children of a node
+// are stored one after the other; the root comes first.
+struct RangeSummary {
+	vector<coord_t> corners;	// lowest, then highest corner of each node
+	vector<int> record_num;		// records below each node
+	vector<int> node_num;		// nodes below each node, the node included
+	vector<int> first;			// index of the first child of each node, -1 if its children are not kept
+	vector<int> child_num;
+	bool built;
+	int changes;				// records inserted or deleted since it was built
+};
+
+// Node capacities picked by RTree::calibrate().
+struct NodeCapacity {
+	int leaf;
+	int internal;
+};
+
+// Distance of RTree::query_radius(): Manhattan, Euclidean or Chebyshev.
+enum DistanceMetric { METRIC_L1, METRIC_L2, METRIC_LINF };
+
+// Which pairs of records a spatial join reports: those that intersect, or those within a
+// given Euclidean distance of each other.
+enum JoinPredicate { JOIN_INTERSECTS, JOIN_WITHIN_DISTANCE };
+
+// Receives the pairs of records found by RTree::join(): one of the tree, one of the other tree.
+class JoinVisitor {
+	public:
+		virtual ~JoinVisitor() {}
+		virtual void visit(const Entry& record, const Entry& other_record) = 0;
+};
+
+// Hash of the key of a record, the coordinates of its corners; see RTree::set_insert_buffer().
+struct KeyHash {
+	size_t operator()(const vector<coord_t>& key) const;
+};
 
 class RTree {
 	public:
 		RTree(int entry_num);//by default, dimension is 2
 		RTree(int entry_num, int dim);
+		RTree(int leaf_entry_num, int entry_num, int dim, TreeEngine engine = GUTTMAN_ENGINE); // separate leaf and internal node capacities
 		~RTree();
 
 	private:
 		bool same_entry(const Entry& e1, const Entry& e2);
-		bool overlap(const BoundingBox box1, const BoundingBox box2);
+		bool overlap(const BoundingBox& box1, const BoundingBox& box2) const;
 		void update_mbr(BoundingBox& mbr, const BoundingBox& new_mbr);
 		BoundingBox get_mbr(Entry* entry_list, int len);
-		int area(const BoundingBox& mbr);
+		BoundingBox get_mbr(const RTNode* node);
+		void append_entry(RTNode* node, const Entry& e);
+		void take_entry(RTNode* node, Entry& e);
+		area_t area(const BoundingBox& mbr);
 		void swap_entry(Entry* entry_list, int id1, int id2);
-		int area_inc(const BoundingBox& mbr, const BoundingBox& entry_mbr);
-		void linear_pick_seeds(Entry* entry_list, int len, int& m1, int& m2);
+		void detach_entry(RTNode* node, int i);
+		area_t area_inc(const BoundingBox& mbr, const BoundingBox& entry_mbr);
+		void linear_pick_seeds(const Entry* entry_list, int len, int& m1, int& m2);
+		void order_split_entries(int len, int m1, int m2);
+		void init_split_scratch();
+		RTNode* create_node(int level);
+		void free_node(RTNode* node);
+		void widen_leaves(RTNode* node);
+		bool record_overlap(const RTNode* leaf, int i, const BoundingBox& mbr) const;
+		int count_buffered(const RTNode* node, const BoundingBox& mbr, RangePredicate pred) const;
+		int find_buffered(const RTNode* node, const BoundingBox& mbr) const;
+		bool find_record(const RTNode* node, const BoundingBox& mbr);
 		RTNode* find_leaf(RTNode* node, RTNode** stack, int* entry_idx, int& stack_size, const Entry& record);
+		RTNode* find_leaf(RTNode* node, RTNode** stack, int* entry_idx, int& stack_size, const BoundingBox& mbr, const BoundingBox* target, int& slot, bool& taken);
+		int choose_subtree(const Entry* entry_list, int len, const BoundingBox& mbr);
 		RTNode* choose_leaf(RTNode** stack, int* entry_idx, int& stack_size, const Entry& record, int dest_level);
+		void split_node(RTNode* node, Entry& entry, Entry& node_entry);
+		void add_entry(vector<Entry>& group, Entry& e);
+		int insert_chunk(const vector<vector<coord_t> >& coordinates, const vector<int>& rids, const vector<unsigned long long>& keys, int begin, int end);
+		int insert_batch(vector<Entry>& group, vector<Entry>& records, const int* idx, int len);
 		void adjust_tree(RTNode** stack, int* entry_idx, int size);
-		void query_range(const RTNode* node, const BoundingBox mbr, int& result_cnt, int& node_travelled);
+		void enlarge_path(RTNode** stack, int* entry_idx, int size, const BoundingBox& mbr);
+		void refit_path(RTNode** stack, int* entry_idx, int size);
+		void query_range(const RTNode* node, const BoundingBox& mbr, RangePredicate pred, int& result_cnt, int& node_travelled);
 		bool query_point(const RTNode* node, const BoundingBox& mbr, Entry& result);
+		void query_range(const RTNode* node, const BoundingBox& mbr, RangePredicate pred, vector<Entry>& results);
+		void query_range_iterative(const BoundingBox& mbr, RangePredicate pred, int& result_cnt, int& node_travelled, QueryScratch& scratch) const;
+		bool query_point_iterative(const BoundingBox& mbr, Entry& result, QueryScratch& scratch) const;
+		void hilbert_sort_nodes(vector<RTNode*>& nodes);
+		RTNode* pack_levels(vector<RTNode*>& nodes, int fanout);
+		void thaw_leaves(int line, vector<RTNode*>& leaves);
+		RTNode* thaw_node(int line);
+		void push_frozen_children(const char* slot, const BoundingBox& mbr, QueryScratch& scratch) const;
+		void query_range_frozen(const BoundingBox& mbr, RangePredicate pred, int& result_cnt, int& node_travelled, QueryScratch& scratch) const;
+		bool query_point_frozen(const BoundingBox& mbr, Entry& result, QueryScratch& scratch) const;
+		void query_frozen_interleaved(const vector<BoundingBox>* ranges, const vector<vector<coord_t> >* points, RangePredicate pred, vector<int>& result_cnt, vector<int>& node_travelled, vector<Entry>* results);
+		int query_range_shared_frozen(const BoundingBox* box, int group, RangePredicate pred, int* result_count, int* node_travelled) const;
+		void query_radius_frozen(const coord_t* center, double radius, DistanceMetric metric, int& result_count, int& node_travelled);
 		bool insert(const Entry& e, int dest_level);
+		void insert(const Entry& e, int dest_level, RTNode** stack, int* entry_idx);
+		unsigned long long hilbert_value(const coord_t* low, const coord_t* high);
+		unsigned long long hilbert_value(const RTNode* node, int i);
+		unsigned long long hilbert_value(const Entry& e, int level);
+		bool widen_hilbert_frame(const BoundingBox& mbr);
+		void hilbert_sort(RTNode* node);
+		void hilbert_redistribute(vector<RTNode*>& group, const Entry& e, unsigned long long key);
+		void hilbert_path(RTNode** stack, int* entry_idx, int size, const BoundingBox& mbr);
+		void hilbert_insert(const Entry& e, int dest_level, RTNode** stack, int* entry_idx);
+		bool insert_buffered(Entry& e);
+		bool has_record(const BoundingBox& mbr);
+		bool erase_buffered(RTNode* node, const BoundingBox& mbr, Entry& record);
+		void take_buffers(RTNode* node, vector<Entry>& records);
+		void rebuffer(vector<Entry>& records);
+		void index_keys(const RTNode* node, bool add);
+		void flush_root(bool all);
+		void flush_buffer(RTNode* node, bool all, vector<Entry>& siblings);
+		void add_child(RTNode* node, Entry& child, vector<Entry>& extra);
+		void add_children(RTNode* node, vector<Entry>& extra, vector<Entry>& siblings);
+		void reinsert(const Entry* entry_list, int len, int dest_level);
+		void reinsert_orphans(vector<RTNode*>& Q);
+		bool shrink_root();
+		int del_range(RTNode* node, const BoundingBox& mbr, RangePredicate pred, vector<RTNode*>& orphans);
 		void stat(RTNode* node, int& record_cnt, int& node_cnt);
+		int add_summary_children(int i, int child_num);
+		void summarize(RTNode* node, int i, int depth);
+		void summarize_frozen(int line, int i, int depth);
+		void count_frozen(int line, int& record_cnt, int& node_cnt) const;
+		BoundingBox frozen_mbr(int line) const;
+		void estimate_range(int i, const BoundingBox& mbr, double& result_cnt, int& node_travelled) const;
 		void print_node(RTNode* node, int indent_level);
 
 
 	public:
 		void stat();
 		void print_tree();
-		bool insert(const vector<int>& coordinate, int rid);
-		void query_range(const BoundingBox& mbr, int& result_count, int& node_travelled);
-		bool query_point(const vector<int>& coordinate, Entry& result);
+		bool insert(const vector<coord_t>& coordinate, int rid);
+		bool insert(const BoundingBox& mbr, int rid);
+		int insert_batch(const vector<vector<coord_t> >& coordinates, const vector<int>& rids);
+		void bulk_load(const vector<Entry>& records);
+		void query_range(const BoundingBox& mbr, int& result_count, int& node_travelled, RangePredicate pred = INTERSECTS);
+		bool query_point(const vector<coord_t>& coordinate, Entry& result);
+		void query_range(const BoundingBox& mbr, int& result_count, int& node_travelled, RangePredicate pred, QueryScratch& scratch) const;
+		bool query_point(const vector<coord_t>& coordinate, Entry& result, QueryScratch& scratch) const;
+		void query_range(const BoundingBox& mbr, vector<Entry>& results, RangePredicate pred = INTERSECTS);
+		void estimate_range(const BoundingBox& mbr, double& result_count, int& node_travelled);
+		void get_records(vector<Entry>& records);
+		void query_range_batch(const vector<BoundingBox>& ranges, vector<int>& result_count, vector<int>& node_travelled, RangePredicate pred = INTERSECTS);
+		int query_range_shared(const vector<BoundingBox>& ranges, vector<int>& result_count, vector<int>& node_travelled, RangePredicate pred = INTERSECTS);
+		int query_point_batch(const vector<vector<coord_t> >& coordinates, vector<Entry>& results, vector<bool>& found);
 		bool tie_breaking(const BoundingBox& box1, const BoundingBox& box2);
-		bool del(const vector<int>& coordinate);
+		bool del(const vector<coord_t>& coordinate);
+		bool del(const BoundingBox& mbr);
         void condense_tree(RTNode* L,RTNode** stack, int* entry_idx, int stack_size);
+		int del_range(const BoundingBox& mbr, RangePredicate pred = INTERSECTS);
+		bool update(const vector<coord_t>& old_coord, const vector<coord_t>& new_coord, double tolerance = 0.05);
+		void freeze(FrozenLayout layout = BREADTH_FIRST, int quantize_bits = 0);
+		void thaw();
+		bool is_frozen() const;
+		RTree* replicate() const;
+		void set_insert_buffer(int capacity);
+		void set_page_buffer(int capacity);
+		const PageBuffer* get_page_buffer() const;
+		void flush_buffers();
+		NodeCapacity capacity() const;
+		void join(const RTree& other, JoinPredicate pred, double distance, JoinVisitor* visitor, long long& pair_count, int& node_travelled);
+		void query_radius(const vector<coord_t>& center, double radius, DistanceMetric metric, int& result_count, int& node_travelled);
+		void skyline(vector<Entry>& result, int& node_travelled);
+		void join_parallel(const RTree& other, JoinPredicate pred, double distance, JoinVisitor* visitor, long long& pair_count, int& node_travelled, int thread_num);
+		static NodeCapacity calibrate(int dim, const vector<vector<coord_t> >& sample, const vector<BoundingBox>& queries);
 
 	private:
-		int max_entry_num;
+		int max_entry_num;	// capacity of internal nodes
+		int max_leaf_num;	// capacity of leaves
 		int dimension;
 		RTNode* root;
+		bool box_records;	// whether leaves store rectangles rather than points
+		TreeEngine engine;
+		int hilbert_bits;	// the Hilbert engine frame of integer coordinates, see widen_hilbert_frame()
+
+		// scratch space of node splits, see split_node()
+		Entry* split_buffer;	// the entries of the overflowing node plus the new entry
+		int* split_order;		// permutation of split_buffer in distribution order
+		int* split_seeds;		// seed candidates of linear_pick_seeds() on each dimension
+		coord_t* split_extent;		// lowest and highest value of the entries on each dimension
+		vector<RTNode*> spare_leaves;	// freed nodes for create_node() to reuse, see free_node()
+		vector<RTNode*> spare_nodes;	// the same for non-leaf nodes
+
+		// the frozen tree, see freeze(); ``root'' is NULL while the tree is frozen
+		char* frozen;			// node slots, the root first, each found by the index of its first cache line
+		int frozen_bits;		// bits of a quantized child MBR coordinate, 0 if they are exact
+		int frozen_fanout;		// children an internal slot holds, above max_entry_num if repacked for quantized MBRs
+		size_t frozen_leaf_ids;		// offset of the record ids in a leaf slot
+		size_t frozen_inner_ids;	// offset of the child slot indices in an internal slot
+		size_t frozen_bytes;		// size of the array
+		QueryScratch query_scratch;	// of the queries made through the tree itself
+
+		// buffer-tree mode, see set_insert_buffer()
+		int buffer_capacity;	// records a node buffer holds before it is flushed, 0 if the mode is off
+		int buffered_num;		// records waiting in the buffers
+		unordered_set<vector<coord_t>, KeyHash> record_keys;	// keys of all the records while the mode is on, see record_key()
+
+		RangeSummary summary;	// see estimate_range()
+
+		// I/O simulation, see set_page_buffer()
+		PageBuffer* page_buffer;	// NULL if the simulation is off
+		int next_page;			// id of the page of the next node created
 };
+
+#endif
@@ -0,0 +1,474 @@
+/* Implementations of the sharded R-tree */
+#include "shardedrtree.h"
+#include "hilbert.h"
+#include <algorithm>
+#include <cmath>
+
+
+const int REBALANCE_MIN_RECORDS = 1024; // records per shard below which skew is not worth fixing
+const double REBALANCE_SKEW = 2.0; // rebalance when a shard holds this many times the average
+const double REBALANCE_BACKOFF = 2.0; // growth of the index before a skew that rebalancing left is tried again
+
+
+//
+// Tasks run by the worker of a shard. The caller waits for a group of them, see run_tasks().
+//
+struct TaskGroup {
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	int pending;
+};
+
+struct ShardTask {
+	TaskGroup* group;
+	virtual ~ShardTask() {}
+	virtual void run(RTree& tree) = 0;
+};
+
+// Insert records; count those inserted and their MBR.
+struct InsertTask : public ShardTask {
+	vector<Entry> records;
+	int inserted;
+	BoundingBox mbr;
+	void run(RTree& tree)
+	{
+		inserted = 0;
+		for (int i = 0; i < records.size(); i++) {
+			if (tree.insert(records[i].get_mbr(), records[i].get_rid())) {
+				if (inserted++ == 0)
+					mbr = records[i].get_mbr();
+				else
+					mbr.group_with(records[i].get_mbr());
+			}
+		}
+	}
+};
+
+struct DeleteTask : public ShardTask {
+	BoundingBox mbr;
+	bool deleted;
+	void run(RTree& tree)
+	{
+		deleted = tree.del(mbr);
+	}
+};
+
+// Answer the queries of ``ranges'' listed in ``ids''.
+struct QueryTask : public ShardTask {
+	const vector<BoundingBox>* ranges;
+	RangePredicate pred;
+	vector<int> ids;
+	vector<int> result_count;
+	vector<int> node_travelled;
+	void run(RTree& tree)
+	{
+		result_count.assign(ids.size(), 0);
+		node_travelled.assign(ids.size(), 0);
+		for (int k = 0; k < ids.size(); k++)
+			tree.query_range((*ranges)[ids[k]], result_count[k], node_travelled[k], pred);
+	}
+};
+
+struct PointTask : public ShardTask {
+	vector<coord_t> coordinate;
+	bool found;
+	Entry result;
+	void run(RTree& tree)
+	{
+		found = tree.query_point(coordinate, result);
+	}
+};
+
+// Hand over every record of the shard, or replace them by ``records''.
+struct RecordsTask : public ShardTask {
+	bool load;
+	vector<Entry> records;
+	void run(RTree& tree)
+	{
+		if (load)
+			tree.bulk_load(records);
+		else
+			tree.get_records(records);
+	}
+};
+
+static void finish_task(ShardTask* task)
+{
+	TaskGroup* group = task->group;
+	pthread_mutex_lock(&group->lock);
+	if (--group->pending == 0)
+		pthread_cond_signal(&group->done);
+	pthread_mutex_unlock(&group->lock);
+}
+
+static void* run_shard_worker(void* arg)
+{
+	Shard& shard = *(Shard*)arg;
+	pthread_mutex_lock(&shard.lock);
+	while (true) {
+		while (shard.tasks.empty() && !shard.stopping)
+			pthread_cond_wait(&shard.wake, &shard.lock);
+		if (shard.tasks.empty())
+			break;
+		ShardTask* task = shard.tasks.front();
+		shard.tasks.pop_front();
+		pthread_mutex_unlock(&shard.lock);
+		task->run(*shard.tree);
+		finish_task(task);
+		pthread_mutex_lock(&shard.lock);
+	}
+	pthread_mutex_unlock(&shard.lock);
+	return NULL;
+}
+
+
+ShardedRTree::ShardedRTree(int leaf_entry_num, int entry_num, int dim, int shard_num, const BoundingBox& domain)
+{
+	max_leaf_num = leaf_entry_num;
+	max_entry_num = entry_num;
+	dimension = dim;
+	this->domain = domain;
+	key_bits = min(32, 64 / dim);
+	shard_num = max(shard_num, 1);
+	rebalance_floor = 0;
+
+	// equal ranges of Hilbert values to begin with
+	unsigned long long step = (key_bits * dim >= 64 ? ~0ULL : (1ULL << (key_bits * dim)) - 1) / shard_num;
+	for (int i = 0; i < shard_num; i++) {
+		bounds.push_back(step * i);
+		Shard* shard = new Shard();
+		shard->tree = new RTree(leaf_entry_num, entry_num, dim);
+		shard->stopping = false;
+		shard->record_num = 0;
+		pthread_mutex_init(&shard->lock, NULL);
+		pthread_cond_init(&shard->wake, NULL);
+		shard->started = pthread_create(&shard->worker, NULL, run_shard_worker, shard) == 0;
+		shards.push_back(shard);
+	}
+}
+
+ShardedRTree::~ShardedRTree()
+{
+	for (int i = 0; i < shards.size(); i++) {
+		Shard* shard = shards[i];
+		pthread_mutex_lock(&shard->lock);
+		shard->stopping = true;
+		pthread_cond_signal(&shard->wake);
+		pthread_mutex_unlock(&shard->lock);
+		if (shard->started)
+			pthread_join(shard->worker, NULL);
+		pthread_cond_destroy(&shard->wake);
+		pthread_mutex_destroy(&shard->lock);
+		delete shard->tree;
+		delete shard;
+	}
+}
+
+
+//
+// Hilbert value of the center of ``mbr'' over the domain, key_bits bits per dimension.
+//
+unsigned long long ShardedRTree::hilbert_value(const BoundingBox& mbr)
+{
+	vector<unsigned int> cell(dimension);
+	long double cells = ldexpl(1, key_bits);
+	for (int j = 0; j < dimension; j++) {
+		long double low = domain.get_lowestValue_at(j);
+		long double extent = (long double)domain.get_highestValue_at(j) - low;
+		long double center = ((long double)mbr.get_lowestValue_at(j) + mbr.get_highestValue_at(j)) / 2;
+		long double x = extent > 0 ? (center - low) / extent * cells : 0;
+		cell[j] = (unsigned int)max((long double)0, min(cells - 1, floorl(x)));
+	}
+	return hilbert_key(cell, key_bits);
+}
+
+//
+// The shard a record belongs to.
+//
+int ShardedRTree::shard_of(const BoundingBox& mbr)
+{
+	return upper_bound(bounds.begin(), bounds.end(), hilbert_value(mbr)) - bounds.begin() - 1;
+}
+
+
+//
+// Give ``tasks[i]'' to the worker of shard ``shard_ids[i]'' and wait until all are done.
+//
+void ShardedRTree::run_tasks(const vector<int>& shard_ids, const vector<ShardTask*>& tasks)
+{
+	TaskGroup group;
+	pthread_mutex_init(&group.lock, NULL);
+	pthread_cond_init(&group.done, NULL);
+	group.pending = tasks.size();
+	for (int i = 0; i < tasks.size(); i++) {
+		Shard* shard = shards[shard_ids[i]];
+		tasks[i]->group = &group;
+		if (!shard->started) {
+			tasks[i]->run(*shard->tree);
+			finish_task(tasks[i]);
+			continue;
+		}
+		pthread_mutex_lock(&shard->lock);
+		shard->tasks.push_back(tasks[i]);
+		pthread_cond_signal(&shard->wake);
+		pthread_mutex_unlock(&shard->lock);
+	}
+	pthread_mutex_lock(&group.lock);
+	while (group.pending > 0)
+		pthread_cond_wait(&group.done, &group.lock);
+	pthread_mutex_unlock(&group.lock);
+	pthread_cond_destroy(&group.done);
+	pthread_mutex_destroy(&group.lock);
+}
+
+
+//
+// Account for ``cnt'' records of MBR ``mbr'' added to ``shard''.
+//
+void ShardedRTree::added(int shard, const BoundingBox& mbr, int cnt)
+{
+	if (cnt == 0)
+		return;
+	if (shards[shard]->record_num == 0)
+		shards[shard]->mbr = mbr;
+	else
+		shards[shard]->mbr.group_with(mbr);
+	shards[shard]->record_num += cnt;
+}
+
+//
+// Whether a shard holds REBALANCE_SKEW times the average number of records, or more, and the
+// index has grown enough since a rebalance that could not remove the skew.
+//
+bool ShardedRTree::skewed()
+{
+	long long total = 0;
+	int most = 0;
+	for (int i = 0; i < shards.size(); i++) {
+		total += shards[i]->record_num;
+		most = max(most, shards[i]->record_num);
+	}
+	return shards.size() > 1 && total >= (long long)REBALANCE_MIN_RECORDS * shards.size()
+		&& total >= rebalance_floor && most >= REBALANCE_SKEW * total / shards.size();
+}
+
+
+//
+// Insert a record into its shard, see RTree::insert().
+//
+bool ShardedRTree::insert(const vector<coord_t>& coordinate, int rid)
+{
+	BoundingBox mbr(coordinate, coordinate);
+	return insert(mbr, rid);
+}
+
+bool ShardedRTree::insert(const BoundingBox& mbr, int rid)
+{
+	vector<BoundingBox> mbrs(1, mbr);
+	vector<int> rids(1, rid);
+	return insert_batch(mbrs, rids) == 1;
+}
+
+//
+// Insert a batch of records, each shard its own share at the same time.
+// Return the number of records inserted.
+//
+int ShardedRTree::insert_batch(const vector<BoundingBox>& mbrs, const vector<int>& rids)
+{
+	vector<InsertTask> parts(shards.size());
+	for (int i = 0; i < mbrs.size(); i++) {
+		if (mbrs[i].get_dim() != dimension) {
+			cerr << "R-tree dimensionality inconsistency\n";
+			return 0;
+		}
+		parts[shard_of(mbrs[i])].records.push_back(Entry(mbrs[i], rids[i]));
+	}
+	vector<int> shard_ids;
+	vector<ShardTask*> tasks;
+	for (int s = 0; s < shards.size(); s++) {
+		if (!parts[s].records.empty()) {
+			shard_ids.push_back(s);
+			tasks.push_back(&parts[s]);
+		}
+	}
+	run_tasks(shard_ids, tasks);
+	int inserted = 0;
+	for (int s = 0; s < shards.size(); s++) {
+		added(s, parts[s].mbr, parts[s].inserted);
+		inserted += parts[s].inserted;
+	}
+	if (skewed())
+		rebalance();
+	return inserted;
+}
+
+
+//
+// Delete the record with exactly the MBR ``mbr'' from its shard, see RTree::del().
+//
+bool ShardedRTree::del(const vector<coord_t>& coordinate)
+{
+	BoundingBox mbr(coordinate, coordinate);
+	return del(mbr);
+}
+
+bool ShardedRTree::del(const BoundingBox& mbr)
+{
+	if (mbr.get_dim() != dimension) {
+		cerr << "R-tree dimensionality inconsistency\n";
+		return false;
+	}
+	DeleteTask task;
+	task.mbr = mbr;
+	int s = shard_of(mbr);
+	run_tasks(vector<int>(1, s), vector<ShardTask*>(1, &task));
+	if (task.deleted)
+		shards[s]->record_num--;
+	return task.deleted;
+}
+
+
+//
+// Range query over the shards whose MBR it meets, see RTree::query_range().
+//
+void ShardedRTree::query_range(const BoundingBox& mbr, int& result_count, int& node_travelled, RangePredicate pred)
+{
+	vector<BoundingBox> ranges(1, mbr);
+	vector<int> result_cnt, node_cnt;
+	query_range_batch(ranges, result_cnt, node_cnt, pred);
+	result_count = result_cnt[0];
+	node_travelled = node_cnt[0];
+}
+
+//
+// Range queries of ``ranges''. Every shard answers the queries that meet its MBR, all shards at
+// the same time; the results and visited nodes of a query are summed over the shards.
+//
+void ShardedRTree::query_range_batch(const vector<BoundingBox>& ranges, vector<int>& result_count, vector<int>& node_travelled, RangePredicate pred)
+{
+	result_count.assign(ranges.size(), 0);
+	node_travelled.assign(ranges.size(), 0);
+	vector<QueryTask> parts(shards.size());
+	vector<int> shard_ids;
+	vector<ShardTask*> tasks;
+	for (int s = 0; s < shards.size(); s++) {
+		if (shards[s]->record_num == 0)
+			continue;
+		for (int i = 0; i < ranges.size(); i++) {
+			if (shards[s]->mbr.is_intersected(ranges[i]))
+				parts[s].ids.push_back(i);
+		}
+		if (!parts[s].ids.empty()) {
+			parts[s].ranges = &ranges;
+			parts[s].pred = pred;
+			shard_ids.push_back(s);
+			tasks.push_back(&parts[s]);
+		}
+	}
+	run_tasks(shard_ids, tasks);
+	for (int s = 0; s < shards.size(); s++) {
+		for (int k = 0; k < parts[s].ids.size(); k++) {
+			result_count[parts[s].ids[k]] += parts[s].result_count[k];
+			node_travelled[parts[s].ids[k]] += parts[s].node_travelled[k];
+		}
+	}
+}
+
+
+//
+// Point query over the shards whose MBR holds the point, see RTree::query_point().
+// A rectangle record belongs to the shard of its center, so it may lie in any of them.
+//
+bool ShardedRTree::query_point(const vector<coord_t>& coordinate, Entry& result)
+{
+	BoundingBox mbr(coordinate, coordinate);
+	vector<PointTask> parts(shards.size());
+	vector<int> shard_ids;
+	vector<ShardTask*> tasks;
+	for (int s = 0; s < shards.size(); s++) {
+		if (shards[s]->record_num > 0 && shards[s]->mbr.is_intersected(mbr)) {
+			parts[s].coordinate = coordinate;
+			shard_ids.push_back(s);
+			tasks.push_back(&parts[s]);
+		}
+	}
+	run_tasks(shard_ids, tasks);
+	for (int k = 0; k < shard_ids.size(); k++) {
+		if (parts[shard_ids[k]].found) {
+			result = parts[shard_ids[k]].result;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+//
+// Move the ranges of the shards so that each holds an equal share of the records. The records
+// are collected from all shards, sorted by Hilbert value and cut into equal slices, records of
+// the same value staying together; each shard then bulk-loads its slice. When records of one
+// value fill the slices of several shards, the shards left without records at the end get no
+// range until the next rebalance.
+//
+void ShardedRTree::rebalance()
+{
+	vector<RecordsTask> parts(shards.size());
+	vector<int> shard_ids;
+	vector<ShardTask*> tasks;
+	for (int s = 0; s < shards.size(); s++) {
+		parts[s].load = false;
+		shard_ids.push_back(s);
+		tasks.push_back(&parts[s]);
+	}
+	run_tasks(shard_ids, tasks);
+
+	vector<Entry> records;
+	for (int s = 0; s < shards.size(); s++) {
+		records.insert(records.end(), parts[s].records.begin(), parts[s].records.end());
+		parts[s].records.clear();
+		parts[s].load = true;
+	}
+	int len = records.size();
+	vector<pair<unsigned long long, int> > order(len);
+	for (int i = 0; i < len; i++) {
+		order[i] = make_pair(hilbert_value(records[i].get_mbr()), i);
+	}
+	sort(order.begin(), order.end());
+
+	int n = shards.size();
+	bounds.resize(1); // the first shard starts at 0
+	for (int s = 0, begin = 0; s < n; s++) {
+		int end = s == n - 1 ? len : max(begin, (int)((long long)len * (s + 1) / n));
+		while (end > begin && end < len && order[end].first == order[end - 1].first)
+			end++;
+		if (s > 0 && begin < len)
+			bounds.push_back(order[begin].first);
+		shards[s]->record_num = 0;
+		for (int i = begin; i < end; i++) {
+			const Entry& record = records[order[i].second];
+			parts[s].records.push_back(record);
+			added(s, record.get_mbr(), 1);
+		}
+		begin = end;
+	}
+	run_tasks(shard_ids, tasks);
+
+	// records of one Hilbert value cannot be split, so the skew may stay; then wait until the
+	// index has grown by REBALANCE_BACKOFF instead of rebalancing after every insert
+	rebalance_floor = 0;
+	if (skewed())
+		rebalance_floor = (long long)(len * REBALANCE_BACKOFF);
+}
+
+
+void ShardedRTree::stat()
+{
+	long long record_cnt = 0;
+	cout << "Number of shards: " << shards.size() << endl;
+	for (int s = 0; s < shards.size(); s++) {
+		cout << "  Shard " << s << ": " << shards[s]->record_num << " records" << endl;
+		record_cnt += shards[s]->record_num;
+	}
+	cout << "Number of records: " << record_cnt << endl;
+	cout << "Dimension: " << dimension << endl;
+}
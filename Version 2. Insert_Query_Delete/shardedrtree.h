@@ -0,0 +1,64 @@
+/* Definitions of the sharded R-tree */
+
+#include "rtree.h"
+#include <deque>
+#include <pthread.h>
+
+struct ShardTask;	// work for the worker of a shard, see shardedrtree.cpp
+
+// A shard of a ShardedRTree: an RTree and the worker thread that owns it. Only the worker
+// touches ``tree''; the calling thread keeps ``mbr'' and ``record_num''.
+struct Shard {
+	RTree* tree;
+	pthread_t worker;
+	bool started;			// whether the worker runs; if not, tasks run on the calling thread
+	pthread_mutex_t lock;	// guards ``tasks'' and ``stopping''
+	pthread_cond_t wake;
+	deque<ShardTask*> tasks;
+	bool stopping;
+
+	BoundingBox mbr;		// covers the records of the shard, possibly more after deletions
+	int record_num;
+};
+
+//
+// One logical index split into ``shard_num'' independent RTrees, each owned by a worker thread.
+// A record belongs to the shard whose range of Hilbert values, over ``domain'', holds the value
+// of its center: inserts and deletes go to that shard only, and a query only to the shards whose
+// MBR it meets. Batches are split by shard and run by all workers at once. When the data is
+// skewed the ranges are moved so the shards hold equal shares again, see rebalance().
+//
+class ShardedRTree {
+	public:
+		ShardedRTree(int leaf_entry_num, int entry_num, int dim, int shard_num, const BoundingBox& domain);
+		~ShardedRTree();
+
+	private:
+		unsigned long long hilbert_value(const BoundingBox& mbr);
+		int shard_of(const BoundingBox& mbr);
+		void run_tasks(const vector<int>& shard_ids, const vector<ShardTask*>& tasks);
+		void added(int shard, const BoundingBox& mbr, int cnt);
+		bool skewed();
+
+	public:
+		bool insert(const vector<coord_t>& coordinate, int rid);
+		bool insert(const BoundingBox& mbr, int rid);
+		int insert_batch(const vector<BoundingBox>& mbrs, const vector<int>& rids);
+		bool del(const vector<coord_t>& coordinate);
+		bool del(const BoundingBox& mbr);
+		void query_range(const BoundingBox& mbr, int& result_count, int& node_travelled, RangePredicate pred = INTERSECTS);
+		void query_range_batch(const vector<BoundingBox>& ranges, vector<int>& result_count, vector<int>& node_travelled, RangePredicate pred = INTERSECTS);
+		bool query_point(const vector<coord_t>& coordinate, Entry& result);
+		void rebalance();
+		void stat();
+
+	private:
+		int max_leaf_num;		// node capacities of the trees of all shards
+		int max_entry_num;
+		int dimension;
+		BoundingBox domain;		// the frame of the Hilbert values; records outside are clamped into it
+		int key_bits;			// bits of the Hilbert value per dimension
+		vector<Shard*> shards;
+		vector<unsigned long long> bounds;	// shard i holds the Hilbert values from bounds[i] up to bounds[i + 1]; shards past the end are empty
+		long long rebalance_floor;	// number of records below which skew is not rebalanced again
+};